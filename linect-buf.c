@@ -35,6 +35,9 @@
 #include <linux/kref.h>
 #include <linux/vmalloc.h>
 #include <linux/mm.h>
+#include <linux/workqueue.h>
+#include <linux/log2.h>
+#include <linux/highmem.h>
 
 #include <linux/usb.h>
 #include <media/v4l2-common.h>
@@ -43,11 +46,24 @@
 #include "linect.h"
 
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3,14,0)
+#define smp_load_acquire(p)		({ typeof(*(p)) ___v = ACCESS_ONCE(*(p)); smp_mb(); ___v; })
+#define smp_store_release(p, v)	do { smp_mb(); ACCESS_ONCE(*(p)) = (v); } while (0)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,34)
+#define flush_kernel_vmap_range(addr, size)	do { } while (0)
+#endif
+
+
 /** 
- * @var default_nbrframebuf
- *   Number of frame buffer by default
+ * @var nbrframebuf
+ *   Number of frame buffers per stream (rounded up to a power of 2, see linect_frame_ring)
  */
-static int default_nbrframebuf = 3;
+static int nbrframebuf = 4;
+
+module_param(nbrframebuf, int, 0444);
+MODULE_PARM_DESC(nbrframebuf, "Number of frame buffers per stream (2-16).");
 
 
 /** 
@@ -111,6 +127,93 @@ void linect_rvfree(void *mem, unsigned long size)
 }
 
 
+/** 
+ * @param image Image buffer
+ * @param userptr Address of the user buffer
+ * @param length Size of the user buffer
+ *
+ * @returns 0 if all is OK
+ *
+ * @brief Pin a user buffer.
+ *
+ * This function pins the pages of a V4L2_MEMORY_USERPTR buffer and maps them
+ * in the kernel, so the frames are converted straight into the user memory.
+ * A buffer queued again at the same address is not pinned again.
+ */
+int linect_pin_image(struct linect_image_buf *image, unsigned long userptr, unsigned int length)
+{
+	int ret;
+	unsigned int npages;
+	void *vaddr;
+
+	if (image->pages != NULL && image->userptr == userptr && image->length == length)
+		return 0;
+
+	linect_unpin_image(image);
+
+	npages = ((userptr + length - 1) >> PAGE_SHIFT) - (userptr >> PAGE_SHIFT) + 1;
+
+	image->pages = kcalloc(npages, sizeof(struct page *), GFP_KERNEL);
+
+	if (image->pages == NULL)
+		return -ENOMEM;
+
+	ret = get_user_pages_fast(userptr & PAGE_MASK, npages, 1, image->pages);
+
+	if (ret > 0)
+		image->npages = ret;
+
+	if (ret != npages) {
+		LNT_ERROR("Failed to pin the user buffer (%d/%d pages)\n", ret, npages);
+		linect_unpin_image(image);
+		return -EFAULT;
+	}
+
+	vaddr = vmap(image->pages, npages, VM_MAP, PAGE_KERNEL);
+
+	if (vaddr == NULL) {
+		linect_unpin_image(image);
+		return -ENOMEM;
+	}
+
+	image->data = vaddr + (userptr & ~PAGE_MASK);
+	image->userptr = userptr;
+	image->length = length;
+
+	return 0;
+}
+
+
+/** 
+ * @param image Image buffer
+ *
+ * @brief Unpin a user buffer.
+ *
+ * This function releases the pages pinned by linect_pin_image. It does nothing
+ * for the images of image_data.
+ */
+void linect_unpin_image(struct linect_image_buf *image)
+{
+	unsigned int i;
+
+	if (image->data != NULL)
+		vunmap((void *) ((unsigned long) image->data & PAGE_MASK));
+
+	for (i=0; i<image->npages; i++) {
+		set_page_dirty_lock(image->pages[i]);
+		put_page(image->pages[i]);
+	}
+
+	kfree(image->pages);
+
+	image->pages = NULL;
+	image->npages = 0;
+	image->data = NULL;
+	image->userptr = 0;
+	image->length = 0;
+}
+
+
 /** 
  * @param dev Device structure
  * 
@@ -123,6 +226,8 @@ void linect_rvfree(void *mem, unsigned long size)
 int linect_allocate_rgb_buffers(struct usb_linect *dev)
 {
 	int i;
+	int err;
+	unsigned int size;
 	void *kbuf;
 
 	LNT_DEBUG("Allocate video buffers\n");
@@ -132,7 +237,8 @@ int linect_allocate_rgb_buffers(struct usb_linect *dev)
 
 	// Allocate frame buffer structure
 	if (dev->cam->framebuf == NULL) {
-		kbuf = kzalloc(default_nbrframebuf * sizeof(struct linect_frame_buf), GFP_KERNEL);
+		size = roundup_pow_of_two(clamp(nbrframebuf, 2, 16));
+		kbuf = kzalloc(size * sizeof(struct linect_frame_buf), GFP_KERNEL);
 
 		if (kbuf == NULL) {
 			LNT_ERROR("Failed to allocate frame buffer structure\n");
@@ -140,22 +246,18 @@ int linect_allocate_rgb_buffers(struct usb_linect *dev)
 		}
 
 		dev->cam->framebuf = kbuf;
+		dev->cam->frame_ring.size = size;
 	}
 
-	// Create frame buffers and make circular ring
-	for (i=0; i<default_nbrframebuf; i++) {
-		if (dev->cam->framebuf[i].data == NULL) {
-			kbuf = vmalloc(LNT_FRAME_SIZE);
+	// Open selects the 640x480 Bayer mode, see usb_linect_rgb_isoc_init
+	err = linect_set_rgb_frame_len(dev, RGB_PKTS_PER_FRAME * RGB_PKTDSIZE);
 
-			if (kbuf == NULL) {
-				LNT_ERROR("Failed to allocate frame buffer %d\n", i);
-				return -ENOMEM;
-			}
+	if (err)
+		return err;
 
-			dev->cam->framebuf[i].data = kbuf;
-			memset(kbuf, 0, LNT_FRAME_SIZE);
-		}
-	}
+	// Image buffers are kept from a previous open
+	if (dev->cam->image_data != NULL)
+		return 0;
 
 	// Allocate image buffer; double buffer for mmap()
 	kbuf = linect_rvmalloc(dev->cam->nbuffers * dev->cam->len_per_image);
@@ -184,6 +286,7 @@ int linect_allocate_rgb_buffers(struct usb_linect *dev)
 int linect_allocate_depth_buffers(struct usb_linect *dev)
 {
 	int i;
+	unsigned int size;
 	void *kbuf;
 
 	LNT_DEBUG("Allocate video buffers\n");
@@ -193,7 +296,8 @@ int linect_allocate_depth_buffers(struct usb_linect *dev)
 
 	// Allocate frame buffer structure
 	if (dev->cam->framebuf_depth == NULL) {
-		kbuf = kzalloc(default_nbrframebuf * sizeof(struct linect_frame_buf), GFP_KERNEL);
+		size = roundup_pow_of_two(clamp(nbrframebuf, 2, 16));
+		kbuf = kzalloc(size * sizeof(struct linect_frame_buf), GFP_KERNEL);
 
 		if (kbuf == NULL) {
 			LNT_ERROR("Failed to allocate frame buffer structure\n");
@@ -201,12 +305,16 @@ int linect_allocate_depth_buffers(struct usb_linect *dev)
 		}
 
 		dev->cam->framebuf_depth = kbuf;
+		dev->cam->frame_ring_depth.size = size;
 	}
 
+	// Frames only hold the packets of the stream, in its largest format
+	dev->cam->frame_ring_depth.frame_bytes = DEPTH_PKTS_PER_FRAME * DEPTH_PKTDSIZE;
+
 	// Create frame buffers and make circular ring
-	for (i=0; i<default_nbrframebuf; i++) {
+	for (i=0; i<dev->cam->frame_ring_depth.size; i++) {
 		if (dev->cam->framebuf_depth[i].data == NULL) {
-			kbuf = vmalloc(LNT_FRAME_SIZE);
+			kbuf = vmalloc(dev->cam->frame_ring_depth.frame_bytes);
 
 			if (kbuf == NULL) {
 				LNT_ERROR("Failed to allocate frame buffer %d\n", i);
@@ -214,10 +322,16 @@ int linect_allocate_depth_buffers(struct usb_linect *dev)
 			}
 
 			dev->cam->framebuf_depth[i].data = kbuf;
-			memset(kbuf, 0, LNT_FRAME_SIZE);
+
+			// Lost packets must not expose stale kernel memory
+			memset(kbuf, 0, dev->cam->frame_ring_depth.frame_bytes);
 		}
 	}
 
+	// Image buffers are kept from a previous open
+	if (dev->cam->image_data_depth != NULL)
+		return 0;
+
 	// Allocate image buffer; double buffer for mmap()
 	kbuf = linect_rvmalloc(dev->cam->nbuffers_depth * dev->cam->len_per_image_depth);
 
@@ -244,6 +358,8 @@ int linect_allocate_depth_buffers(struct usb_linect *dev)
 	if (kbuf == NULL) {
 		LNT_ERROR("Failed to allocate image temp buffer. needed (%d)\n",
 				640*480*2);
+		linect_rvfree(dev->cam->image_data_depth, dev->cam->nbuffers_depth * dev->cam->len_per_image_depth);
+		dev->cam->image_data_depth = NULL;
 		return -ENOMEM;
 	}
 	dev->cam->image_tmp = kbuf;
@@ -287,32 +403,41 @@ int linect_reset_rgb_buffers(struct usb_linect *dev)
 
 	spin_lock_irqsave(&dev->cam->spinlock_rgb, flags);
 
-	dev->cam->full_frames = NULL;
-	dev->cam->full_frames_tail = NULL;
-
-	for (i=0; i<dev->cam->nbuffers; i++) {
+	for (i=0; i<dev->cam->frame_ring.size; i++) {
 		dev->cam->framebuf[i].filled = 0;
 		dev->cam->framebuf[i].errors = 0;
-
-		if (i > 0)
-			dev->cam->framebuf[i].next = &dev->cam->framebuf[i - 1];
-		else
-			dev->cam->framebuf->next = NULL;
 	}
 
-	dev->cam->empty_frames = &dev->cam->framebuf[dev->cam->nbuffers - 1];
-	dev->cam->empty_frames_tail = dev->cam->framebuf;
+	dev->cam->frame_ring.head = 0;
+	dev->cam->frame_ring.tail = 0;
+	dev->cam->frame_ring.lost = 0;
+	dev->cam->frame_ring.skipped = 0;
+	dev->cam->fill_frame = dev->cam->framebuf;
 	dev->cam->read_frame = NULL;
-	dev->cam->fill_frame = dev->cam->empty_frames;
-	dev->cam->empty_frames = dev->cam->empty_frames->next;
 
 	dev->cam->image_read_pos = 0;
-	dev->cam->fill_image = 0;
+	dev->cam->fill_image = -1;
+	dev->cam->read_image = -1;
+	dev->cam->sequence = 0;
+	dev->cam->memory = V4L2_MEMORY_MMAP;
+	dev->cam->user_image_state = LNT_IMAGE_DEQUEUED;
+
+	INIT_LIST_HEAD(&dev->cam->queued_images);
+	INIT_LIST_HEAD(&dev->cam->done_images);
+
+	// All the images are queued to the driver, for read()
+	for (i=0; i<dev->cam->nbuffers; i++) {
+		dev->cam->image_state[i] = LNT_IMAGE_QUEUED;
+		dev->cam->image_seq[i] = 0;
+		list_add_tail(&dev->cam->images[i].list, &dev->cam->queued_images);
+	}
 
 	spin_unlock_irqrestore(&dev->cam->spinlock_rgb, flags);
 
 	for (i=0; i<dev->cam->nbuffers; i++)
 		dev->cam->image_used[i] = 0;
+
+	linect_sync_reset(dev, LNT_SYNC_RGB);
 	
 	return 0;
 }
@@ -326,32 +451,41 @@ int linect_reset_depth_buffers(struct usb_linect *dev)
 
 	spin_lock_irqsave(&dev->cam->spinlock_depth, flags);
 
-	dev->cam->full_frames_depth = NULL;
-	dev->cam->full_frames_tail_depth = NULL;
-
-	for (i=0; i<dev->cam->nbuffers_depth; i++) {
+	for (i=0; i<dev->cam->frame_ring_depth.size; i++) {
 		dev->cam->framebuf_depth[i].filled = 0;
 		dev->cam->framebuf_depth[i].errors = 0;
-
-		if (i > 0)
-			dev->cam->framebuf_depth[i].next = &dev->cam->framebuf_depth[i - 1];
-		else
-			dev->cam->framebuf_depth->next = NULL;
 	}
 
-	dev->cam->empty_frames_depth = &dev->cam->framebuf_depth[dev->cam->nbuffers_depth - 1];
-	dev->cam->empty_frames_tail_depth = dev->cam->framebuf_depth;
+	dev->cam->frame_ring_depth.head = 0;
+	dev->cam->frame_ring_depth.tail = 0;
+	dev->cam->frame_ring_depth.lost = 0;
+	dev->cam->frame_ring_depth.skipped = 0;
+	dev->cam->fill_frame_depth = dev->cam->framebuf_depth;
 	dev->cam->read_frame_depth = NULL;
-	dev->cam->fill_frame_depth = dev->cam->empty_frames_depth;
-	dev->cam->empty_frames_depth = dev->cam->empty_frames_depth->next;
 
 	dev->cam->image_read_pos_depth = 0;
-	dev->cam->fill_image_depth = 0;
+	dev->cam->fill_image_depth = -1;
+	dev->cam->read_image_depth = -1;
+	dev->cam->sequence_depth = 0;
+	dev->cam->memory_depth = V4L2_MEMORY_MMAP;
+	dev->cam->user_image_state_depth = LNT_IMAGE_DEQUEUED;
+
+	INIT_LIST_HEAD(&dev->cam->queued_images_depth);
+	INIT_LIST_HEAD(&dev->cam->done_images_depth);
+
+	// All the images are queued to the driver, for read()
+	for (i=0; i<dev->cam->nbuffers_depth; i++) {
+		dev->cam->image_state_depth[i] = LNT_IMAGE_QUEUED;
+		dev->cam->image_seq_depth[i] = 0;
+		list_add_tail(&dev->cam->images_depth[i].list, &dev->cam->queued_images_depth);
+	}
 
 	spin_unlock_irqrestore(&dev->cam->spinlock_depth, flags);
 
 	for (i=0; i<dev->cam->nbuffers_depth; i++)
 		dev->cam->image_used_depth[i] = 0;
+
+	linect_sync_reset(dev, LNT_SYNC_DEPTH);
 	
 	return 0;
 }
@@ -401,7 +535,7 @@ int linect_free_rgb_buffers(struct usb_linect *dev)
 
 	// Release frame buffers
 	if (dev->cam->framebuf != NULL) {
-		for (i=0; i<default_nbrframebuf; i++) {
+		for (i=0; i<dev->cam->frame_ring.size; i++) {
 			if (dev->cam->framebuf[i].data != NULL) {
 				vfree(dev->cam->framebuf[i].data);
 				dev->cam->framebuf[i].data = NULL;
@@ -413,6 +547,9 @@ int linect_free_rgb_buffers(struct usb_linect *dev)
 	}
 
 	// Release image buffers
+	for (i=0; i<LNT_MAX_IMAGES; i++)
+		linect_unpin_image(&dev->cam->images[i]);
+
 	if (dev->cam->image_data != NULL)
 		linect_rvfree(dev->cam->image_data, dev->cam->nbuffers * dev->cam->len_per_image);
 
@@ -432,7 +569,7 @@ int linect_free_depth_buffers(struct usb_linect *dev)
 
 	// Release frame buffers
 	if (dev->cam->framebuf_depth != NULL) {
-		for (i=0; i<default_nbrframebuf; i++) {
+		for (i=0; i<dev->cam->frame_ring_depth.size; i++) {
 			if (dev->cam->framebuf_depth[i].data != NULL) {
 				vfree(dev->cam->framebuf_depth[i].data);
 				dev->cam->framebuf_depth[i].data = NULL;
@@ -444,6 +581,9 @@ int linect_free_depth_buffers(struct usb_linect *dev)
 	}
 
 	// Release image buffers
+	for (i=0; i<LNT_MAX_IMAGES; i++)
+		linect_unpin_image(&dev->cam->images_depth[i]);
+
 	if (dev->cam->image_data_depth != NULL)
 		linect_rvfree(dev->cam->image_data_depth, dev->cam->nbuffers_depth * dev->cam->len_per_image_depth);
 
@@ -465,220 +605,1084 @@ int linect_free_depth_buffers(struct usb_linect *dev)
 
 
 /** 
- * @param dev Device structure
- *
- * @brief Prepare the next image.
- *
- * This function is called when an image is ready, so as to prepare the next image.
+ * @var linect_pools
+ *   Devices whose buffers are kept while they are closed
  */
-void linect_next_rgb_image(struct usb_linect *dev)
+static LIST_HEAD(linect_pools);
+static DEFINE_MUTEX(linect_pools_lock);
+
+
+/** 
+ * @param cam Camera structure
+ * 
+ * @returns Number of pages held by the closed streams of the camera
+ */
+static unsigned long linect_pool_pages(struct linect_cam *cam)
 {
-	dev->cam->image_used[dev->cam->fill_image] = 0;
-	dev->cam->fill_image = (dev->cam->fill_image + 1) % dev->cam->nbuffers;
+	unsigned long size = 0;
+
+	if (cam->vopen_rgb == 0 && cam->image_data != NULL)
+		size += cam->frame_ring.size * cam->frame_ring.frame_bytes
+			+ cam->nbuffers * cam->len_per_image;
+
+	if (cam->vopen_depth == 0 && cam->image_data_depth != NULL)
+		size += cam->frame_ring_depth.size * cam->frame_ring_depth.frame_bytes
+			+ cam->nbuffers_depth * cam->len_per_image_depth + 640*480*2;
+
+	return size >> PAGE_SHIFT;
 }
 
-void linect_next_depth_image(struct usb_linect *dev)
+
+/** 
+ * @returns Number of pages that can be released
+ */
+static unsigned long linect_pool_count(void)
 {
-	dev->cam->image_used_depth[dev->cam->fill_image_depth] = 0;
-	dev->cam->fill_image_depth = (dev->cam->fill_image_depth + 1) % dev->cam->nbuffers;
+	struct linect_cam *cam;
+	unsigned long pages = 0;
+
+	if (!mutex_trylock(&linect_pools_lock))
+		return 0;
+
+	list_for_each_entry(cam, &linect_pools, pool)
+		pages += linect_pool_pages(cam);
+
+	mutex_unlock(&linect_pools_lock);
+
+	return pages;
 }
 
 
 /** 
- * @param dev Device structure
- * 
- * @returns 0 if all is OK
+ * @returns Number of pages released
  *
- * @brief Prepare the next frame.
+ * @brief Release the buffers of the closed streams.
  *
- * This function is called when a frame is ready, so as to prepare the next frame.
+ * The locks are only tried, so that an open in progress, which may itself
+ * be reclaiming memory, is skipped.
  */
-int linect_next_rgb_frame(struct usb_linect *dev)
+static unsigned long linect_pool_release(void)
 {
-	int ret = 0;
-	unsigned long flags;
+	struct linect_cam *cam;
+	unsigned long pages = 0;
+
+	if (!mutex_trylock(&linect_pools_lock))
+		return 0;
+
+	list_for_each_entry(cam, &linect_pools, pool) {
+		if (mutex_trylock(&cam->modlock_rgb)) {
+			if (cam->vopen_rgb == 0 && cam->image_data != NULL) {
+				pages += cam->frame_ring.size * cam->frame_ring.frame_bytes >> PAGE_SHIFT;
+				pages += cam->nbuffers * cam->len_per_image >> PAGE_SHIFT;
+				linect_free_rgb_buffers(cam->dev);
+			}
 
-	//LNT_DEBUG("Select next frame\n");
+			mutex_unlock(&cam->modlock_rgb);
+		}
 
-	spin_lock_irqsave(&dev->cam->spinlock_rgb, flags);
+		if (mutex_trylock(&cam->modlock_depth)) {
+			if (cam->vopen_depth == 0 && cam->image_data_depth != NULL) {
+				pages += cam->frame_ring_depth.size * cam->frame_ring_depth.frame_bytes >> PAGE_SHIFT;
+				pages += (cam->nbuffers_depth * cam->len_per_image_depth + 640*480*2) >> PAGE_SHIFT;
+				linect_free_depth_buffers(cam->dev);
+			}
 
-	if (dev->cam->fill_frame != NULL) {
-		if (dev->cam->full_frames == NULL) {
-			dev->cam->full_frames = dev->cam->fill_frame;
-			dev->cam->full_frames_tail = dev->cam->full_frames;
-		}
-		else {
-			dev->cam->full_frames_tail->next = dev->cam->fill_frame;
-			dev->cam->full_frames_tail = dev->cam->fill_frame;
+			mutex_unlock(&cam->modlock_depth);
 		}
 	}
 
-	if (dev->cam->empty_frames != NULL) {
-		dev->cam->fill_frame = dev->cam->empty_frames;
-		dev->cam->empty_frames = dev->cam->empty_frames->next;
-	}
-	else {
-		if (dev->cam->full_frames == NULL) {
-			LNT_ERROR("Neither empty or full frames available!\n");
-			spin_unlock_irqrestore(&dev->cam->spinlock_rgb, flags);
-			return -EINVAL;
-		}
+	mutex_unlock(&linect_pools_lock);
 
-		dev->cam->fill_frame = dev->cam->full_frames;
-		dev->cam->full_frames = dev->cam->full_frames->next;
+	LNT_DEBUG("Shrinker released %lu pages\n", pages);
 
-		ret = 1;
-	}
+	return pages;
+}
 
-	dev->cam->fill_frame->next = NULL;
 
-	spin_unlock_irqrestore(&dev->cam->spinlock_rgb, flags);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,35)
+static int linect_pool_shrink(struct shrinker *shrinker, int nr_to_scan, gfp_t gfp_mask)
+#else
+static int linect_pool_shrink(int nr_to_scan, gfp_t gfp_mask)
+#endif
+{
+	if (nr_to_scan)
+		linect_pool_release();
 
-	return ret;
+	return linect_pool_count();
 }
 
-int linect_next_depth_frame(struct usb_linect *dev)
-{
-	int ret = 0;
-	unsigned long flags;
+static struct shrinker linect_pool_shrinker = {
+	.shrink = linect_pool_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
 
-	//LNT_DEBUG("Select next frame\n");
 
-	spin_lock_irqsave(&dev->cam->spinlock_depth, flags);
+/** 
+ * @brief Register the buffer pool shrinker.
+ *
+ * The buffers of a device are allocated on first open and kept across
+ * opens. They are only released on disconnect or under memory pressure.
+ */
+void linect_pool_init(void)
+{
+	register_shrinker(&linect_pool_shrinker);
+}
 
-	if (dev->cam->fill_frame_depth != NULL) {
-		if (dev->cam->full_frames_depth == NULL) {
-			dev->cam->full_frames_depth = dev->cam->fill_frame_depth;
-			dev->cam->full_frames_tail_depth = dev->cam->full_frames_depth;
-		}
-		else {
-			dev->cam->full_frames_tail_depth->next = dev->cam->fill_frame_depth;
-			dev->cam->full_frames_tail_depth = dev->cam->fill_frame_depth;
-		}
-	}
+void linect_pool_exit(void)
+{
+	unregister_shrinker(&linect_pool_shrinker);
+}
 
-	if (dev->cam->empty_frames_depth != NULL) {
-		dev->cam->fill_frame_depth = dev->cam->empty_frames_depth;
-		dev->cam->empty_frames_depth = dev->cam->empty_frames_depth->next;
-	}
-	else {
-		if (dev->cam->full_frames_depth == NULL) {
-			LNT_ERROR("Neither empty or full frames available!\n");
-			spin_unlock_irqrestore(&dev->cam->spinlock_depth, flags);
-			return -EINVAL;
-		}
 
-		dev->cam->fill_frame_depth = dev->cam->full_frames_depth;
-		dev->cam->full_frames_depth = dev->cam->full_frames_depth->next;
+/** 
+ * @param dev Device structure
+ *
+ * @brief Add a device to the buffer pool.
+ */
+void linect_pool_add(struct usb_linect *dev)
+{
+	mutex_lock(&linect_pools_lock);
+	list_add_tail(&dev->cam->pool, &linect_pools);
+	mutex_unlock(&linect_pools_lock);
+}
 
-		ret = 1;
-	}
 
-	dev->cam->fill_frame_depth->next = NULL;
+/** 
+ * @param dev Device structure
+ *
+ * @brief Remove a device from the buffer pool and release its buffers.
+ */
+void linect_pool_del(struct usb_linect *dev)
+{
+	mutex_lock(&linect_pools_lock);
+	list_del(&dev->cam->pool);
+	mutex_unlock(&linect_pools_lock);
 
-	spin_unlock_irqrestore(&dev->cam->spinlock_depth, flags);
+	mutex_lock(&dev->cam->modlock_rgb);
+	linect_free_rgb_buffers(dev);
+	mutex_unlock(&dev->cam->modlock_rgb);
 
-	return ret;
+	mutex_lock(&dev->cam->modlock_depth);
+	linect_free_depth_buffers(dev);
+	mutex_unlock(&dev->cam->modlock_depth);
 }
 
 
 /** 
  * @param dev Device structure
- * 
+ * @param nbuffers Number of images
+ *
  * @returns 0 if all is OK
  *
- * @brief Handler frame
+ * @brief Set the number of images.
  *
- * This function gets called for the isochronous pipe. This function is only called 
- * when a frame is ready. So we have to be fast to decompress the data.
+ * This function is called by VIDIOC_REQBUFS. The image buffer is allocated
+ * again when its size changes, so the stream must be stopped and no image
+ * may be mapped. All the images are given to the application, which queues
+ * them with VIDIOC_QBUF.
  */
-int linect_handle_rgb_frame(struct usb_linect *dev)
+int linect_set_rgb_nbuffers(struct usb_linect *dev, unsigned int nbuffers)
 {
-	int ret = 0;
-	unsigned long flags;
+	int i;
+	void *kbuf;
 
-	LNT_DEBUG("Sync Handle Frame\n");
+	if (nbuffers != dev->cam->nbuffers || dev->cam->image_data == NULL) {
+		kbuf = linect_rvmalloc(nbuffers * dev->cam->len_per_image);
 
-	spin_lock_irqsave(&dev->cam->spinlock_rgb, flags);
+		if (kbuf == NULL) {
+			LNT_ERROR("Failed to allocate image buffer(s). needed (%d)\n",
+					nbuffers * dev->cam->len_per_image);
+			return -ENOMEM;
+		}
 
-	if (dev->cam->read_frame != NULL) {
-		spin_unlock_irqrestore(&dev->cam->spinlock_rgb, flags);
-		return ret;
-	}
+		if (dev->cam->image_data != NULL)
+			linect_rvfree(dev->cam->image_data, dev->cam->nbuffers * dev->cam->len_per_image);
 
-	if (dev->cam->full_frames == NULL) {
+		dev->cam->image_data = kbuf;
+		dev->cam->nbuffers = nbuffers;
 	}
-	else {
-		dev->cam->read_frame = dev->cam->full_frames;
-		dev->cam->full_frames = dev->cam->full_frames->next;
-		dev->cam->read_frame->next = NULL;
+
+	for (i=0; i<LNT_MAX_IMAGES; i++) {
+		dev->cam->images[i].offset = (i < nbuffers) ? i * dev->cam->len_per_image : 0;
+		dev->cam->images[i].vma_use_count = 0;
+		linect_unpin_image(&dev->cam->images[i]);
 	}
 
-	if (dev->cam->read_frame != NULL) {
-		spin_unlock_irqrestore(&dev->cam->spinlock_rgb, flags);
-		ret = linect_rgb_decompress(dev);
-		spin_lock_irqsave(&dev->cam->spinlock_rgb, flags);
+	linect_reset_rgb_buffers(dev);
+	linect_flush_rgb_images(dev);
 
-		if (dev->cam->empty_frames == NULL) {
-			dev->cam->empty_frames = dev->cam->read_frame;
-			dev->cam->empty_frames_tail = dev->cam->empty_frames;
-		}
-		else {
-			dev->cam->empty_frames_tail->next = dev->cam->read_frame;
-			dev->cam->empty_frames_tail = dev->cam->read_frame;
-		}
+	return 0;
+}
 
-		dev->cam->read_frame = NULL;
+/** 
+ * @param dev Device structure
+ * @param len Size of an image
+ *
+ * @returns 0 if all is OK
+ *
+ * @brief Resize the images for a new frame size.
+ *
+ * The number of images is kept. The images must not be mapped.
+ */
+int linect_set_rgb_image_len(struct usb_linect *dev, unsigned int len)
+{
+	int i;
+	void *kbuf;
+
+	for (i=0; i<dev->cam->nbuffers; i++) {
+		if (dev->cam->images[i].vma_use_count)
+			return -EBUSY;
 	}
 
-	spin_unlock_irqrestore(&dev->cam->spinlock_rgb, flags);
+	kbuf = linect_rvmalloc(dev->cam->nbuffers * len);
 
-	return ret;
+	if (kbuf == NULL) {
+		LNT_ERROR("Failed to allocate image buffer(s). needed (%d)\n",
+				dev->cam->nbuffers * len);
+		return -ENOMEM;
+	}
+
+	if (dev->cam->image_data != NULL)
+		linect_rvfree(dev->cam->image_data, dev->cam->nbuffers * dev->cam->len_per_image);
+
+	dev->cam->image_data = kbuf;
+	dev->cam->len_per_image = len;
+
+	// Same count : only lays the images out again
+	return linect_set_rgb_nbuffers(dev, dev->cam->nbuffers);
 }
 
-int linect_handle_depth_frame(struct usb_linect *dev)
+/** 
+ * @param dev Device structure
+ * @param len Size of a frame
+ *
+ * @returns 0 if all is OK
+ *
+ * @brief Resize the frame ring for a new stream mode.
+ *
+ * The frames only hold the packets of the selected mode. Frames of another
+ * size are released and allocated again. The stream must be stopped.
+ */
+int linect_set_rgb_frame_len(struct usb_linect *dev, unsigned int len)
 {
-	int ret = 0;
-	unsigned long flags;
-
-	LNT_DEBUG("Sync Handle Frame\n");
+	int i;
+	void *kbuf;
 
-	spin_lock_irqsave(&dev->cam->spinlock_depth, flags);
+	if (len != dev->cam->frame_ring.frame_bytes) {
+		for (i=0; i<dev->cam->frame_ring.size; i++) {
+			vfree(dev->cam->framebuf[i].data);
+			dev->cam->framebuf[i].data = NULL;
+		}
 
-	if (dev->cam->read_frame_depth != NULL) {
-		spin_unlock_irqrestore(&dev->cam->spinlock_depth, flags);
-		return ret;
+		dev->cam->frame_ring.frame_bytes = len;
 	}
 
-	if (dev->cam->full_frames_depth == NULL) {
-	}
-	else {
-		dev->cam->read_frame_depth = dev->cam->full_frames_depth;
-		dev->cam->full_frames_depth = dev->cam->full_frames_depth->next;
-		dev->cam->read_frame_depth->next = NULL;
-	}
+	// Create frame buffers and make circular ring
+	for (i=0; i<dev->cam->frame_ring.size; i++) {
+		if (dev->cam->framebuf[i].data == NULL) {
+			kbuf = vmalloc(len);
 
-	if (dev->cam->read_frame_depth != NULL) {
-		spin_unlock_irqrestore(&dev->cam->spinlock_depth, flags);
-		ret = linect_depth_decompress(dev);
-		//ret = linect_decompress(dev);
-		//LNT_DEBUG("descomprime frame depth\n");
-		spin_lock_irqsave(&dev->cam->spinlock_depth, flags);
+			if (kbuf == NULL) {
+				LNT_ERROR("Failed to allocate frame buffer %d\n", i);
+				return -ENOMEM;
+			}
+
+			dev->cam->framebuf[i].data = kbuf;
 
-		if (dev->cam->empty_frames_depth == NULL) {
-			dev->cam->empty_frames_depth = dev->cam->read_frame_depth;
-			dev->cam->empty_frames_tail_depth = dev->cam->empty_frames_depth;
+			// Lost packets must not expose stale kernel memory
+			memset(kbuf, 0, len);
 		}
-		else {
-			dev->cam->empty_frames_tail_depth->next = dev->cam->read_frame_depth;
-			dev->cam->empty_frames_tail_depth = dev->cam->read_frame_depth;
+	}
+
+	return 0;
+}
+
+int linect_set_depth_nbuffers(struct usb_linect *dev, unsigned int nbuffers)
+{
+	int i;
+	void *kbuf;
+
+	if (nbuffers != dev->cam->nbuffers_depth || dev->cam->image_data_depth == NULL) {
+		kbuf = linect_rvmalloc(nbuffers * dev->cam->len_per_image_depth);
+
+		if (kbuf == NULL) {
+			LNT_ERROR("Failed to allocate image buffer(s). needed (%d)\n",
+					nbuffers * dev->cam->len_per_image_depth);
+			return -ENOMEM;
 		}
 
-		dev->cam->read_frame_depth = NULL;
+		if (dev->cam->image_data_depth != NULL)
+			linect_rvfree(dev->cam->image_data_depth, dev->cam->nbuffers_depth * dev->cam->len_per_image_depth);
+
+		dev->cam->image_data_depth = kbuf;
+		dev->cam->nbuffers_depth = nbuffers;
 	}
 
-	spin_unlock_irqrestore(&dev->cam->spinlock_depth, flags);
+	for (i=0; i<LNT_MAX_IMAGES; i++) {
+		dev->cam->images_depth[i].offset = (i < nbuffers) ? i * dev->cam->len_per_image_depth : 0;
+		dev->cam->images_depth[i].vma_use_count = 0;
+		linect_unpin_image(&dev->cam->images_depth[i]);
+	}
 
-	return ret;
+	linect_reset_depth_buffers(dev);
+	linect_flush_depth_images(dev);
+
+	return 0;
 }
 
+
+/** 
+ * @param dev Device structure
+ * 
+ * @returns Index of the image, -1 if none is ready
+ *
+ * @brief Dequeue the oldest image done.
+ *
+ * This function hands the first image of the done list over to the
+ * application. The image belongs to the application until it is queued again.
+ */
+int linect_get_rgb_image(struct usb_linect *dev)
+{
+	int ret = -1;
+	unsigned long flags;
+	struct linect_image_buf *buf;
+
+	spin_lock_irqsave(&dev->cam->spinlock_rgb, flags);
+
+	if (!list_empty(&dev->cam->done_images)) {
+		buf = list_first_entry(&dev->cam->done_images, struct linect_image_buf, list);
+		list_del(&buf->list);
+
+		ret = buf - dev->cam->images;
+		dev->cam->image_state[ret] = LNT_IMAGE_DEQUEUED;
+		dev->cam->read_image = ret;
+	}
+
+	spin_unlock_irqrestore(&dev->cam->spinlock_rgb, flags);
+
+	return ret;
+}
+
+int linect_get_depth_image(struct usb_linect *dev)
+{
+	int ret = -1;
+	unsigned long flags;
+	struct linect_image_buf *buf;
+
+	spin_lock_irqsave(&dev->cam->spinlock_depth, flags);
+
+	if (!list_empty(&dev->cam->done_images_depth)) {
+		buf = list_first_entry(&dev->cam->done_images_depth, struct linect_image_buf, list);
+		list_del(&buf->list);
+
+		ret = buf - dev->cam->images_depth;
+		dev->cam->image_state_depth[ret] = LNT_IMAGE_DEQUEUED;
+		dev->cam->read_image_depth = ret;
+	}
+
+	spin_unlock_irqrestore(&dev->cam->spinlock_depth, flags);
+
+	return ret;
+}
+
+
+/** 
+ * @param dev Device structure
+ *
+ * @brief Release the image held by the reader.
+ *
+ * This function is called when an image has been read, so as to queue it
+ * again to the conversion work.
+ */
+void linect_next_rgb_image(struct usb_linect *dev)
+{
+	int image = dev->cam->read_image;
+
+	if (image >= 0) {
+		dev->cam->image_used[image] = 0;
+		linect_queue_rgb_image(dev, image);
+	}
+}
+
+void linect_next_depth_image(struct usb_linect *dev)
+{
+	int image = dev->cam->read_image_depth;
+
+	if (image >= 0) {
+		dev->cam->image_used_depth[image] = 0;
+		linect_queue_depth_image(dev, image);
+	}
+}
+
+
+/** 
+ * @param dev Device structure
+ * @param index Index of the image
+ *
+ * @returns 0 if all is OK, -EINVAL if the application does not own the image
+ *
+ * @brief Queue an image.
+ *
+ * This function adds an image dequeued by the application at the end of the
+ * queued list, where the conversion work takes the images to fill.
+ */
+int linect_queue_rgb_image(struct usb_linect *dev, unsigned int index)
+{
+	int ret = 0;
+	unsigned long flags;
+
+	if (index >= dev->cam->nbuffers)
+		return -EINVAL;
+
+	spin_lock_irqsave(&dev->cam->spinlock_rgb, flags);
+
+	if (dev->cam->image_state[index] != LNT_IMAGE_DEQUEUED)
+		ret = -EINVAL;
+	else {
+		dev->cam->image_state[index] = LNT_IMAGE_QUEUED;
+		list_add_tail(&dev->cam->images[index].list, &dev->cam->queued_images);
+
+		if (dev->cam->read_image == (int) index)
+			dev->cam->read_image = -1;
+	}
+
+	spin_unlock_irqrestore(&dev->cam->spinlock_rgb, flags);
+
+	return ret;
+}
+
+int linect_queue_depth_image(struct usb_linect *dev, unsigned int index)
+{
+	int ret = 0;
+	unsigned long flags;
+
+	if (index >= dev->cam->nbuffers_depth)
+		return -EINVAL;
+
+	spin_lock_irqsave(&dev->cam->spinlock_depth, flags);
+
+	if (dev->cam->image_state_depth[index] != LNT_IMAGE_DEQUEUED)
+		ret = -EINVAL;
+	else {
+		dev->cam->image_state_depth[index] = LNT_IMAGE_QUEUED;
+		list_add_tail(&dev->cam->images_depth[index].list, &dev->cam->queued_images_depth);
+
+		if (dev->cam->read_image_depth == (int) index)
+			dev->cam->read_image_depth = -1;
+	}
+
+	spin_unlock_irqrestore(&dev->cam->spinlock_depth, flags);
+
+	return ret;
+}
+
+
+/** 
+ * @param dev Device structure
+ *
+ * @returns 1 if a user buffer is queued
+ *
+ * @brief Look for a queued user buffer.
+ *
+ * A V4L2_MEMORY_USERPTR buffer is checked against view_size when it is queued.
+ * The frame size can therefore not change while one of them is queued.
+ */
+int linect_rgb_userptr_queued(struct usb_linect *dev)
+{
+	int i;
+
+	if (dev->cam->memory != V4L2_MEMORY_USERPTR)
+		return 0;
+
+	for (i=0; i<dev->cam->nbuffers; i++) {
+		if (dev->cam->image_state[i] == LNT_IMAGE_QUEUED)
+			return 1;
+	}
+
+	return 0;
+}
+
+int linect_depth_userptr_queued(struct usb_linect *dev)
+{
+	int i;
+
+	if (dev->cam->memory_depth != V4L2_MEMORY_USERPTR)
+		return 0;
+
+	for (i=0; i<dev->cam->nbuffers_depth; i++) {
+		if (dev->cam->image_state_depth[i] == LNT_IMAGE_QUEUED)
+			return 1;
+	}
+
+	return 0;
+}
+
+
+/** 
+ * @param dev Device structure
+ *
+ * @brief Give all the images to the application.
+ *
+ * This function empties the queued and done lists when the stream is stopped
+ * or the images are requested again. The conversion work must be idle.
+ */
+void linect_flush_rgb_images(struct usb_linect *dev)
+{
+	int i;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->cam->spinlock_rgb, flags);
+
+	INIT_LIST_HEAD(&dev->cam->queued_images);
+	INIT_LIST_HEAD(&dev->cam->done_images);
+
+	for (i=0; i<dev->cam->nbuffers; i++)
+		dev->cam->image_state[i] = LNT_IMAGE_DEQUEUED;
+
+	dev->cam->fill_image = -1;
+	dev->cam->read_image = -1;
+
+	spin_unlock_irqrestore(&dev->cam->spinlock_rgb, flags);
+
+	wake_up_interruptible(&dev->cam->wait_rgb_frame);
+}
+
+void linect_flush_depth_images(struct usb_linect *dev)
+{
+	int i;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->cam->spinlock_depth, flags);
+
+	INIT_LIST_HEAD(&dev->cam->queued_images_depth);
+	INIT_LIST_HEAD(&dev->cam->done_images_depth);
+
+	for (i=0; i<dev->cam->nbuffers_depth; i++)
+		dev->cam->image_state_depth[i] = LNT_IMAGE_DEQUEUED;
+
+	dev->cam->fill_image_depth = -1;
+	dev->cam->read_image_depth = -1;
+
+	spin_unlock_irqrestore(&dev->cam->spinlock_depth, flags);
+
+	wake_up_interruptible(&dev->cam->wait_depth_frame);
+}
+
+
+/** 
+ * @param dev Device structure
+ * @param userptr Address of the user buffer
+ * @param length Size of a frame
+ *
+ * @returns 0 if all is OK
+ *
+ * @brief Wait for a frame in a user buffer.
+ *
+ * This function is called by read() when a whole frame is requested. The
+ * buffer of the reader is pinned and the next frame is converted straight
+ * into it, instead of being converted into image_data and copied again. The
+ * pages stay pinned until linect_disarm_rgb_read, in the same read() call.
+ */
+int linect_arm_rgb_read(struct usb_linect *dev, unsigned long userptr, unsigned int length)
+{
+	int ret;
+	unsigned long flags;
+
+	ret = linect_pin_image(&dev->cam->user_image, userptr, length);
+
+	if (ret)
+		return ret;
+
+	spin_lock_irqsave(&dev->cam->spinlock_rgb, flags);
+	dev->cam->user_image_state = LNT_IMAGE_QUEUED;
+	spin_unlock_irqrestore(&dev->cam->spinlock_rgb, flags);
+
+	return 0;
+}
+
+int linect_arm_depth_read(struct usb_linect *dev, unsigned long userptr, unsigned int length)
+{
+	int ret;
+	unsigned long flags;
+
+	ret = linect_pin_image(&dev->cam->user_image_depth, userptr, length);
+
+	if (ret)
+		return ret;
+
+	spin_lock_irqsave(&dev->cam->spinlock_depth, flags);
+	dev->cam->user_image_state_depth = LNT_IMAGE_QUEUED;
+	spin_unlock_irqrestore(&dev->cam->spinlock_depth, flags);
+
+	return 0;
+}
+
+
+/** 
+ * @param dev Device structure
+ *
+ * @brief Stop waiting for a frame in the user buffer.
+ *
+ * This function returns once the conversion work no longer writes the user
+ * buffer, and releases its pages. The reader may free the buffer once read()
+ * returns, so the pages are pinned again by the next call.
+ */
+void linect_disarm_rgb_read(struct usb_linect *dev)
+{
+	int state;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->cam->spinlock_rgb, flags);
+	state = dev->cam->user_image_state;
+	dev->cam->user_image_state = LNT_IMAGE_DEQUEUED;
+	spin_unlock_irqrestore(&dev->cam->spinlock_rgb, flags);
+
+	// The conversion work may still be writing the user buffer
+	if (state == LNT_IMAGE_QUEUED)
+		flush_work(&dev->cam->rgb_work);
+
+	linect_unpin_image(&dev->cam->user_image);
+}
+
+void linect_disarm_depth_read(struct usb_linect *dev)
+{
+	int state;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->cam->spinlock_depth, flags);
+	state = dev->cam->user_image_state_depth;
+	dev->cam->user_image_state_depth = LNT_IMAGE_DEQUEUED;
+	spin_unlock_irqrestore(&dev->cam->spinlock_depth, flags);
+
+	// The conversion work may still be writing the user buffer
+	if (state == LNT_IMAGE_QUEUED)
+		flush_work(&dev->cam->depth_work);
+
+	linect_unpin_image(&dev->cam->user_image_depth);
+}
+
+
+/** 
+ * @param dev Device structure
+ * 
+ * @returns 1 if the frame has been lost
+ *
+ * @brief Prepare the next frame.
+ *
+ * This function is called by the isochronous tasklet when a frame is ready. It
+ * publishes the frame and fills the next buffer. When the conversion work still
+ * holds every other buffer, the frame is not published and its buffer is filled
+ * again : the newest frame is lost (see lost). The older frames
+ * already published stay for the work, which only converts the newest of them
+ * (see skipped).
+ */
+int linect_next_rgb_frame(struct usb_linect *dev)
+{
+	struct linect_frame_ring *ring = &dev->cam->frame_ring;
+	unsigned int head = ring->head;
+
+	if (head + 1 - smp_load_acquire(&ring->tail) >= ring->size) {
+		ring->lost++;
+		return 1;
+	}
+
+	smp_store_release(&ring->head, head + 1);
+
+	dev->cam->fill_frame = &dev->cam->framebuf[(head + 1) & (ring->size - 1)];
+
+	return 0;
+}
+
+int linect_next_depth_frame(struct usb_linect *dev)
+{
+	struct linect_frame_ring *ring = &dev->cam->frame_ring_depth;
+	unsigned int head = ring->head;
+
+	if (head + 1 - smp_load_acquire(&ring->tail) >= ring->size) {
+		ring->lost++;
+		return 1;
+	}
+
+	smp_store_release(&ring->head, head + 1);
+
+	dev->cam->fill_frame_depth = &dev->cam->framebuf_depth[(head + 1) & (ring->size - 1)];
+
+	return 0;
+}
+
+
+/** 
+ * @param dev Device structure
+ * @param tolerance Maximal skew of a pair in device ticks, 0 to disable the pairing
+ *
+ * @brief Restart the pairing stage and clear its statistics.
+ *
+ * The shared sequence number goes on, so that the numbers seen by the
+ * application never go back.
+ */
+void linect_sync_init(struct usb_linect *dev, unsigned int tolerance)
+{
+	int i;
+	unsigned long flags;
+	struct linect_sync *sync = &dev->cam->sync;
+
+	spin_lock_irqsave(&sync->lock, flags);
+
+	sync->tolerance = tolerance;
+
+	for (i=0; i<LNT_SYNC_NSTREAMS; i++) {
+		sync->pending[i] = 0;
+		sync->last_seq[i] = sync->sequence - 1;
+		sync->unpaired[i] = 0;
+	}
+
+	sync->pairs = 0;
+	sync->skew = 0;
+	sync->skew_min = 0;
+	sync->skew_max = 0;
+	sync->skew_sum = 0;
+
+	spin_unlock_irqrestore(&sync->lock, flags);
+}
+
+
+/** 
+ * @param dev Device structure
+ * @param stream Stream restarted, see T_LNT_SYNC_STREAM
+ *
+ * @brief Forget the image of a stream waiting for its mate.
+ */
+void linect_sync_reset(struct usb_linect *dev, int stream)
+{
+	unsigned long flags;
+	struct linect_sync *sync = &dev->cam->sync;
+
+	spin_lock_irqsave(&sync->lock, flags);
+
+	sync->pending[stream] = 0;
+	sync->last_seq[stream] = sync->sequence - 1;
+
+	spin_unlock_irqrestore(&sync->lock, flags);
+}
+
+
+/** 
+ * @param dev Device structure
+ * @param stream Stream of the image, see T_LNT_SYNC_STREAM
+ * @param timestamp Device timestamp of the frame
+ * @param sequence Number of images of the stream
+ *
+ * @returns Sequence number of the image
+ *
+ * @brief Number an image, pairing it with the last image of the other stream.
+ *
+ * Both streams are stamped by the same device clock. When the image of the
+ * other stream waiting for its mate is closer than the tolerance, the image
+ * takes its sequence number. Else the image takes a new number and waits in
+ * turn. So the pairing costs no latency: each image is given to the
+ * application as soon as it is converted. An image only pairs with a newer
+ * number than the last one of its stream, so the numbers never go back.
+ * Without pairing (tolerance 0), each stream numbers its images itself.
+ */
+static unsigned int linect_sync_frame(struct usb_linect *dev, int stream,
+		uint32_t timestamp, unsigned int *sequence)
+{
+	int skew;
+	unsigned int seq;
+	unsigned long flags;
+	struct linect_sync *sync = &dev->cam->sync;
+	int other = (stream == LNT_SYNC_RGB) ? LNT_SYNC_DEPTH : LNT_SYNC_RGB;
+
+	spin_lock_irqsave(&sync->lock, flags);
+
+	if (sync->tolerance == 0) {
+		seq = (*sequence)++;
+		spin_unlock_irqrestore(&sync->lock, flags);
+		return seq;
+	}
+
+	// The previous image of the stream found no mate
+	if (sync->pending[stream]) {
+		sync->pending[stream] = 0;
+		sync->unpaired[stream]++;
+	}
+
+	// Wraps with the 32 bits device clock
+	skew = (int) (timestamp - sync->timestamp[other]);
+
+	if (sync->pending[other] && abs(skew) <= (int) sync->tolerance &&
+			(int) (sync->pending_seq[other] - sync->last_seq[stream]) > 0) {
+		seq = sync->pending_seq[other];
+		sync->pending[other] = 0;
+
+		if (stream == LNT_SYNC_RGB)
+			skew = -skew;
+
+		if (sync->pairs == 0 || skew < sync->skew_min)
+			sync->skew_min = skew;
+		if (sync->pairs == 0 || skew > sync->skew_max)
+			sync->skew_max = skew;
+
+		sync->skew = skew;
+		sync->skew_sum += abs(skew);
+		sync->pairs++;
+	}
+	else {
+		// Too old to pair with the next images
+		if (sync->pending[other] && skew > (int) sync->tolerance) {
+			sync->pending[other] = 0;
+			sync->unpaired[other]++;
+		}
+
+		seq = sync->sequence++;
+		sync->pending[stream] = 1;
+		sync->timestamp[stream] = timestamp;
+		sync->pending_seq[stream] = seq;
+	}
+
+	sync->last_seq[stream] = seq;
+
+	// Without pairing, the stream goes on from its last number
+	*sequence = seq + 1;
+
+	spin_unlock_irqrestore(&sync->lock, flags);
+
+	return seq;
+}
+
+
+/** 
+ * @param dev Device structure
+ * 
+ * @returns 0 if all is OK
+ *
+ * @brief Handler frame
+ *
+ * This function converts the newest frame published by the tasklet into the
+ * first image of the queued list, then moves it to the done list. Older frames
+ * are released without conversion and counted as skipped. When no image is
+ * queued the frame is dropped too, which is not an error: an image is never
+ * written while the application may read it. A reader waiting in read() for a whole frame goes
+ * first, and gets the frame straight in its buffer.
+ */
+int linect_handle_rgb_frame(struct usb_linect *dev)
+{
+	int image;
+	int ret = 0;
+	void *data;
+	unsigned int seq;
+	uint32_t timestamp;
+	unsigned long flags;
+	struct linect_image_buf *buf;
+	struct linect_frame_ring *ring = &dev->cam->frame_ring;
+	unsigned int tail = ring->tail;
+	unsigned int head = smp_load_acquire(&ring->head);
+
+	while (head != tail) {
+		// Only the newest frame is converted
+		ring->skipped += head - tail - 1;
+		dev->cam->read_frame = &dev->cam->framebuf[(head - 1) & (ring->size - 1)];
+
+		image = -1;
+		data = NULL;
+
+		spin_lock_irqsave(&dev->cam->spinlock_rgb, flags);
+
+		if (dev->cam->user_image_state == LNT_IMAGE_QUEUED) {
+			// A reader waits for this frame in its own buffer
+			data = dev->cam->user_image.data;
+		}
+		else {
+			// Take the first queued image, user buffers too small stay queued
+			list_for_each_entry(buf, &dev->cam->queued_images, list) {
+				if (buf->data == NULL || buf->length >= dev->cam->view_size) {
+					image = buf - dev->cam->images;
+					break;
+				}
+			}
+
+			if (image < 0)
+				dev->cam->vframes_dumped++;
+			else {
+				list_del(&buf->list);
+				dev->cam->fill_image = image;
+
+				if (buf->data != NULL)
+					data = buf->data;
+				else
+					data = dev->cam->image_data + buf->offset;
+			}
+		}
+
+		spin_unlock_irqrestore(&dev->cam->spinlock_rgb, flags);
+
+		ret = (data != NULL) ? linect_rgb_decompress(dev, data) : 0;
+		timestamp = dev->cam->read_frame->timestamp;
+
+		// Give the frames back to the tasklet
+		dev->cam->read_frame = NULL;
+		tail = head;
+		smp_store_release(&ring->tail, tail);
+
+		if (ret || data == NULL) {
+			// The image is filled again with the next frame
+			if (image >= 0) {
+				spin_lock_irqsave(&dev->cam->spinlock_rgb, flags);
+				list_add(&dev->cam->images[image].list, &dev->cam->queued_images);
+				spin_unlock_irqrestore(&dev->cam->spinlock_rgb, flags);
+			}
+		}
+		else if (image < 0) {
+			flush_kernel_vmap_range(data, dev->cam->view_size);
+
+			spin_lock_irqsave(&dev->cam->spinlock_rgb, flags);
+			dev->cam->user_image_state = LNT_IMAGE_DONE;
+			spin_unlock_irqrestore(&dev->cam->spinlock_rgb, flags);
+
+			wake_up_interruptible(&dev->cam->wait_rgb_frame);
+		}
+		else {
+			// Write back the kernel mapping of a user buffer
+			if (dev->cam->images[image].data != NULL)
+				flush_kernel_vmap_range(data, dev->cam->view_size);
+
+			seq = linect_sync_frame(dev, LNT_SYNC_RGB, timestamp, &dev->cam->sequence);
+
+			spin_lock_irqsave(&dev->cam->spinlock_rgb, flags);
+			dev->cam->image_state[image] = LNT_IMAGE_DONE;
+			dev->cam->image_seq[image] = seq;
+			list_add_tail(&dev->cam->images[image].list, &dev->cam->done_images);
+			spin_unlock_irqrestore(&dev->cam->spinlock_rgb, flags);
+
+			wake_up_interruptible(&dev->cam->wait_rgb_frame);
+		}
+
+		head = smp_load_acquire(&ring->head);
+	}
+
+	return ret;
+}
+
+int linect_handle_depth_frame(struct usb_linect *dev)
+{
+	int image;
+	int ret = 0;
+	void *data;
+	unsigned int seq;
+	uint32_t timestamp;
+	unsigned long flags;
+	struct linect_image_buf *buf;
+	struct linect_frame_ring *ring = &dev->cam->frame_ring_depth;
+	unsigned int tail = ring->tail;
+	unsigned int head = smp_load_acquire(&ring->head);
+
+	while (head != tail) {
+		// Only the newest frame is converted
+		ring->skipped += head - tail - 1;
+		dev->cam->read_frame_depth = &dev->cam->framebuf_depth[(head - 1) & (ring->size - 1)];
+
+		image = -1;
+		data = NULL;
+
+		spin_lock_irqsave(&dev->cam->spinlock_depth, flags);
+
+		if (dev->cam->user_image_state_depth == LNT_IMAGE_QUEUED) {
+			// A reader waits for this frame in its own buffer
+			data = dev->cam->user_image_depth.data;
+		}
+		else {
+			// Take the first queued image, user buffers too small stay queued
+			list_for_each_entry(buf, &dev->cam->queued_images_depth, list) {
+				if (buf->data == NULL || buf->length >= dev->cam->view_size_depth) {
+					image = buf - dev->cam->images_depth;
+					break;
+				}
+			}
+
+			if (image < 0)
+				dev->cam->vframes_dumped++;
+			else {
+				list_del(&buf->list);
+				dev->cam->fill_image_depth = image;
+
+				if (buf->data != NULL)
+					data = buf->data;
+				else
+					data = dev->cam->image_data_depth + buf->offset;
+			}
+		}
+
+		spin_unlock_irqrestore(&dev->cam->spinlock_depth, flags);
+
+		ret = (data != NULL) ? linect_depth_decompress(dev, data) : 0;
+		timestamp = dev->cam->read_frame_depth->timestamp;
+
+		// Give the frames back to the tasklet
+		dev->cam->read_frame_depth = NULL;
+		tail = head;
+		smp_store_release(&ring->tail, tail);
+
+		if (ret || data == NULL) {
+			// The image is filled again with the next frame
+			if (image >= 0) {
+				spin_lock_irqsave(&dev->cam->spinlock_depth, flags);
+				list_add(&dev->cam->images_depth[image].list, &dev->cam->queued_images_depth);
+				spin_unlock_irqrestore(&dev->cam->spinlock_depth, flags);
+			}
+		}
+		else if (image < 0) {
+			flush_kernel_vmap_range(data, dev->cam->view_size_depth);
+
+			spin_lock_irqsave(&dev->cam->spinlock_depth, flags);
+			dev->cam->user_image_state_depth = LNT_IMAGE_DONE;
+			spin_unlock_irqrestore(&dev->cam->spinlock_depth, flags);
+
+			wake_up_interruptible(&dev->cam->wait_depth_frame);
+		}
+		else {
+			// Write back the kernel mapping of a user buffer
+			if (dev->cam->images_depth[image].data != NULL)
+				flush_kernel_vmap_range(data, dev->cam->view_size_depth);
+
+			seq = linect_sync_frame(dev, LNT_SYNC_DEPTH, timestamp, &dev->cam->sequence_depth);
+
+			spin_lock_irqsave(&dev->cam->spinlock_depth, flags);
+			dev->cam->image_state_depth[image] = LNT_IMAGE_DONE;
+			dev->cam->image_seq_depth[image] = seq;
+			list_add_tail(&dev->cam->images_depth[image].list, &dev->cam->done_images_depth);
+			spin_unlock_irqrestore(&dev->cam->spinlock_depth, flags);
+
+			wake_up_interruptible(&dev->cam->wait_depth_frame);
+		}
+
+		head = smp_load_acquire(&ring->head);
+	}
+
+	return ret;
+}
+
+
+/** 
+ * @param work Conversion work of the device
+ *
+ * @brief Conversion work
+ *
+ * This function is queued by the isochronous handler each time a frame is
+ * complete. It runs on the device workqueue, so the decompression no longer
+ * takes place in read() nor in VIDIOC_DQBUF.
+ */
+void linect_rgb_work(struct work_struct *work)
+{
+	struct linect_cam *cam = container_of(work, struct linect_cam, rgb_work);
+
+	if (linect_handle_rgb_frame(cam->dev))
+		LNT_ERROR("Failed to convert the RGB frame !\n");
+}
+
+void linect_depth_work(struct work_struct *work)
+{
+	struct linect_cam *cam = container_of(work, struct linect_cam, depth_work);
+
+	if (linect_handle_depth_frame(cam->dev))
+		LNT_ERROR("Failed to convert the depth frame !\n");
+}
@@ -428,10 +428,32 @@ int linect_cam_start_rgb(struct usb_linect *dev)
 	if (dev->cam->startupinit) return 0;
 	mutex_lock(&dev->cam->mutex_cam);
 	linect_cam_write_register(dev, 0x05, 0x00); // reset rgb stream
-	linect_cam_write_register(dev, 0x0c, 0x00);
-	linect_cam_write_register(dev, 0x0d, 0x01);
-	linect_cam_write_register(dev, 0x0e, 0x1e); // 30Hz bayer
-	linect_cam_write_register(dev, 0x05, 0x01); // start rgb stream
+
+	if (dev->cam->rgb_format == LNT_RGB_UYVY) {
+		linect_cam_write_register(dev, 0x0c, 0x05);
+		linect_cam_write_register(dev, 0x0d, 0x01);
+		linect_cam_write_register(dev, 0x0e, 0x0f); // 15Hz uyvy
+	}
+	else if (dev->cam->rgb_format == LNT_RGB_IR) {
+		linect_cam_write_register(dev, 0x105, 0x00); // disable auto-cycle of projector
+		linect_cam_write_register(dev, 0x17, 0x01); // 640x488
+		linect_cam_write_register(dev, 0x18, 0x1e); // 30Hz ir
+	}
+	else if (dev->cam->rgb_format == LNT_RGB_BAYER_HR) {
+		linect_cam_write_register(dev, 0x0c, 0x00);
+		linect_cam_write_register(dev, 0x0d, 0x02); // 1280x1024
+		linect_cam_write_register(dev, 0x0e, 0x0f); // 15Hz bayer
+	}
+	else {
+		linect_cam_write_register(dev, 0x0c, 0x00);
+		linect_cam_write_register(dev, 0x0d, 0x01);
+		linect_cam_write_register(dev, 0x0e, dev->cam->vsettings.fps); // 15 or 30Hz bayer
+	}
+
+	if (dev->cam->rgb_format == LNT_RGB_IR)
+		linect_cam_write_register(dev, 0x05, 0x03); // start ir stream
+	else
+		linect_cam_write_register(dev, 0x05, 0x01); // start rgb stream
 	linect_cam_write_register(dev, 0x47, 0x00); // disable Hflip
 	mutex_unlock(&dev->cam->mutex_cam);
 	return 0;
@@ -451,9 +473,12 @@ int linect_cam_start_depth(struct usb_linect *dev)
 	if (dev->cam->startupinit) return 0;
 	mutex_lock(&dev->cam->mutex_cam);
 	linect_cam_write_register(dev, 0x06, 0x00); // reset depth stream
-	linect_cam_write_register(dev, 0x12, 0x03);
+	if (dev->cam->depth_format == LNT_DEPTH_10BIT)
+		linect_cam_write_register(dev, 0x12, 0x02); // 10 bits packed
+	else
+		linect_cam_write_register(dev, 0x12, 0x03); // 11 bits packed
 	linect_cam_write_register(dev, 0x13, 0x01);
-	linect_cam_write_register(dev, 0x14, 0x1e);
+	linect_cam_write_register(dev, 0x14, dev->cam->depth_vsettings.fps); // 15 or 30Hz
 	//linect_cam_write_register(dev, 0x06, 0x02);
 	//linect_cam_write_register(dev, 0x06, 0x00);
 	//linect_cam_write_register(dev, 0x16, 0x01);
@@ -0,0 +1,48 @@
+/** 
+ * @file linect-simd-ssse3.c
+ * @author Arturo Casal
+ * @date 2010
+ * @version v0.1
+ *
+ * @brief Driver for MS Kinect
+ *
+ * @note Copyright (C) Arturo Casal
+ *
+ * @par Licences
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+/*
+ * SSSE3 (x86_64) build of the vector kernels.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/types.h>
+
+#include <linux/usb.h>
+#include <media/v4l2-common.h>
+
+#include "linect.h"
+
+
+#define LNT_SIMD_VL			16
+#define LNT_SIMD_NAME(fn)		fn##_ssse3
+#define LNT_SIMD_SHUFFLE
+
+#include "linect-simd.h"
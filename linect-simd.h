@@ -0,0 +1,384 @@
+/** 
+ * @file linect-simd.h
+ * @author Arturo Casal
+ * @date 2010
+ * @version v0.1
+ *
+ * @brief Driver for MS Kinect
+ *
+ * @note Copyright (C) Arturo Casal
+ *
+ * @par Licences
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+/*
+ * Vector kernels shared by all the SIMD units.
+ *
+ * This file is not a normal header : it is included once by each
+ * linect-simd-<isa>.c, after LNT_SIMD_VL (vector width in bytes) and
+ * LNT_SIMD_NAME(fn) (symbol suffix) have been defined. The code only uses
+ * the SSE2/SSSE3 builtins of GCC 4.3 and the vector operators (+, *, &, |,
+ * ~) that GCC 4.x already has : no vector shift, compare, subscript or
+ * conversion. LNT_SIMD_SHUFFLE tells that the ISA has a byte shuffle
+ * instruction.
+ *
+ * Every kernel must give exactly the same result as the scalar code in
+ * linect-bayer.c. The caller is in charge of kernel_fpu_begin/end.
+ */
+
+#ifndef LNT_SIMD_VL
+#error "LNT_SIMD_VL must be defined before including linect-simd.h"
+#endif
+
+#if LNT_SIMD_VL != 16
+#error "linect-simd.h only has 128 bits kernels"
+#endif
+
+typedef char lnt_v16qi __attribute__((vector_size(16)));
+typedef short lnt_v8hi __attribute__((vector_size(16)));
+typedef long long lnt_v2di __attribute__((vector_size(16)));
+
+
+/**
+ * @brief Fill the 16 bytes of a vector with the same value
+ *
+ * @param v Value (0 to 255)
+ */
+static __always_inline lnt_v16qi lnt_splat8(const int v)
+{
+	const char c = v;
+
+	return (lnt_v16qi) { c, c, c, c, c, c, c, c, c, c, c, c, c, c, c, c };
+}
+
+
+/**
+ * @brief Widen the 8 low bytes of a vector to 16 bits
+ */
+static __always_inline lnt_v8hi lnt_lo16(lnt_v16qi v)
+{
+	const lnt_v16qi zero = { 0 };
+
+	return (lnt_v8hi) __builtin_ia32_punpcklbw128(v, zero);
+}
+
+
+/**
+ * @brief Widen the 8 high bytes of a vector to 16 bits
+ */
+static __always_inline lnt_v8hi lnt_hi16(lnt_v16qi v)
+{
+	const lnt_v16qi zero = { 0 };
+
+	return (lnt_v8hi) __builtin_ia32_punpckhbw128(v, zero);
+}
+
+
+/**
+ * @brief Lane select
+ *
+ * @param m Mask (all ones or all zeros per lane)
+ * @param a Value of the lanes where the mask is set
+ * @param b Value of the lanes where the mask is clear
+ */
+static __always_inline lnt_v8hi lnt_select(lnt_v8hi m, lnt_v8hi a, lnt_v8hi b)
+{
+	return (a & m) | (b & ~m);
+}
+
+
+/**
+ * @brief Apply an offset with saturation to [0, 255]
+ *
+ * Same result as tone_apply() in linect-bayer.c. One of inc and dec is
+ * always zero.
+ *
+ * @param v Values
+ * @param inc Positive part of the offset, see lnt_splat8
+ * @param dec Negative part of the offset, see lnt_splat8
+ */
+static __always_inline lnt_v16qi lnt_tone(lnt_v16qi v, lnt_v16qi inc, lnt_v16qi dec)
+{
+	return __builtin_ia32_psubusb128(__builtin_ia32_paddusb128(v, inc), dec);
+}
+
+
+/**
+ * @brief Demosaic 8 pixels, widened to 16 bits
+ *
+ * Same arithmetic as bayer_row() in linect-bayer.c. The even lanes are
+ * the odd columns of the row.
+ *
+ * @param odd Odd row (BGBG) if not 0
+ * @param m Mask of the odd lanes
+ */
+static __always_inline void lnt_bayer_half(lnt_v8hi ul, lnt_v8hi u, lnt_v8hi ur,
+		lnt_v8hi cl, lnt_v8hi c, lnt_v8hi cr, lnt_v8hi dl, lnt_v8hi d, lnt_v8hi dr,
+		const int odd, lnt_v8hi m, lnt_v8hi *r, lnt_v8hi *g, lnt_v8hi *b)
+{
+	lnt_v8hi hor, ver, cross, diag;
+
+	hor = __builtin_ia32_psrlwi128(cl + cr, 1);
+	ver = __builtin_ia32_psrlwi128(u + d, 1);
+	cross = __builtin_ia32_psrlwi128(u + d + cl + cr, 2);
+	diag = __builtin_ia32_psrlwi128(ul + ur + dl + dr, 2);
+
+	if (!odd) {
+		// Even lanes : R site, odd lanes : G site
+		*r = lnt_select(m, hor, c);
+		*g = lnt_select(m, c, cross);
+		*b = lnt_select(m, ver, diag);
+	}
+	else {
+		// Even lanes : G site, odd lanes : B site
+		*r = lnt_select(m, diag, ver);
+		*g = lnt_select(m, cross, c);
+		*b = lnt_select(m, c, hor);
+	}
+}
+
+
+/**
+ * @brief Store 4 pixels of 4 bytes as 3 bytes pixels
+ *
+ * Two pixels are packed per 64 bits lane. The stores overlap : the 2 last
+ * bytes of each one are overwritten by the next pixels, as in the scalar
+ * code which always writes the pixels after the block.
+ *
+ * @param out Output of the first pixel
+ * @param px Pixels (byte 3 is 0)
+ */
+static __always_inline void lnt_store_rgb24(uint8_t *out, lnt_v8hi px)
+{
+	const lnt_v2di lo = { 0xffffffLL, 0xffffffLL };
+	const lnt_v2di hi = { 0xffffff000000LL, 0xffffff000000LL };
+	lnt_v2di q = (lnt_v2di) px;
+	long long l;
+
+	q = (q & lo) | (__builtin_ia32_psrlqi128(q, 8) & hi);
+
+	l = __builtin_ia32_vec_ext_v2di(q, 0);
+	__builtin_memcpy(out, &l, 8);
+	l = __builtin_ia32_vec_ext_v2di(q, 1);
+	__builtin_memcpy(out + 6, &l, 8);
+}
+
+
+/**
+ * @brief Demosaic LNT_SIMD_VL pixels of a row
+ *
+ * The first pixel of the block must be on an odd column (R or G site),
+ * and the lanes x-1 to x+LNT_SIMD_VL must be inside the row.
+ *
+ * @param up Previous source row
+ * @param cur Current source row
+ * @param down Next source row
+ * @param out Output of the first pixel of the block
+ * @param x Column of the first pixel of the block
+ * @param odd Odd row (BGBG) if not 0
+ * @param bpp Bytes per output pixel (3 or 4)
+ * @param ro Offset of the red byte
+ * @param inc Positive part of the offset
+ * @param dec Negative part of the offset
+ * @param m Mask of the odd lanes
+ */
+static __always_inline void lnt_bayer_block(const uint8_t *up, const uint8_t *cur,
+		const uint8_t *down, uint8_t *out, int x, const int odd, const int bpp,
+		const int ro, lnt_v16qi inc, lnt_v16qi dec, lnt_v8hi m)
+{
+	const lnt_v16qi zero = { 0 };
+	lnt_v16qi ul, u, ur, cl, c, cr, dl, d, dr;
+	lnt_v8hi rl, gl, bl, rh, gh, bh;
+	lnt_v16qi r, g, b, p0, p2;
+	lnt_v8hi p0g, p2z, px[4];
+	int i;
+
+	ul = __builtin_ia32_loaddqu((const char *) (up + x - 1));
+	u = __builtin_ia32_loaddqu((const char *) (up + x));
+	ur = __builtin_ia32_loaddqu((const char *) (up + x + 1));
+	cl = __builtin_ia32_loaddqu((const char *) (cur + x - 1));
+	c = __builtin_ia32_loaddqu((const char *) (cur + x));
+	cr = __builtin_ia32_loaddqu((const char *) (cur + x + 1));
+	dl = __builtin_ia32_loaddqu((const char *) (down + x - 1));
+	d = __builtin_ia32_loaddqu((const char *) (down + x));
+	dr = __builtin_ia32_loaddqu((const char *) (down + x + 1));
+
+	lnt_bayer_half(lnt_lo16(ul), lnt_lo16(u), lnt_lo16(ur), lnt_lo16(cl),
+			lnt_lo16(c), lnt_lo16(cr), lnt_lo16(dl), lnt_lo16(d), lnt_lo16(dr),
+			odd, m, &rl, &gl, &bl);
+	lnt_bayer_half(lnt_hi16(ul), lnt_hi16(u), lnt_hi16(ur), lnt_hi16(cl),
+			lnt_hi16(c), lnt_hi16(cr), lnt_hi16(dl), lnt_hi16(d), lnt_hi16(dr),
+			odd, m, &rh, &gh, &bh);
+
+	// Back to bytes : the values are 0 to 255, packuswb does not clip
+	r = lnt_tone(__builtin_ia32_packuswb128(rl, rh), inc, dec);
+	g = lnt_tone(__builtin_ia32_packuswb128(gl, gh), inc, dec);
+	b = lnt_tone(__builtin_ia32_packuswb128(bl, bh), inc, dec);
+
+	p0 = ro ? b : r;
+	p2 = ro ? r : b;
+
+	// Interleave to 4 bytes pixels : p0, g, p2, 0
+	p0g = (lnt_v8hi) __builtin_ia32_punpcklbw128(p0, g);
+	p2z = (lnt_v8hi) __builtin_ia32_punpcklbw128(p2, zero);
+	px[0] = (lnt_v8hi) __builtin_ia32_punpcklwd128(p0g, p2z);
+	px[1] = (lnt_v8hi) __builtin_ia32_punpckhwd128(p0g, p2z);
+
+	p0g = (lnt_v8hi) __builtin_ia32_punpckhbw128(p0, g);
+	p2z = (lnt_v8hi) __builtin_ia32_punpckhbw128(p2, zero);
+	px[2] = (lnt_v8hi) __builtin_ia32_punpcklwd128(p0g, p2z);
+	px[3] = (lnt_v8hi) __builtin_ia32_punpckhwd128(p0g, p2z);
+
+	for (i=0; i<4; i++) {
+		if (bpp == 4)
+			__builtin_ia32_storedqu((char *) (out + 16 * i), (lnt_v16qi) px[i]);
+		else
+			lnt_store_rgb24(out + 12 * i, px[i]);
+	}
+}
+
+
+/**
+ * @brief Demosaic the interior of a row
+ *
+ * @param up Previous source row
+ * @param cur Current source row
+ * @param down Next source row
+ * @param out Output of the pixel 1 of the row
+ * @param width Width of the row
+ * @param odd Odd row (BGBG) if not 0
+ * @param bpp Bytes per output pixel (3 or 4)
+ * @param ro Offset of the red byte
+ * @param offset Brightness offset
+ *
+ * @returns Number of pixels written
+ */
+static __always_inline int lnt_bayer_row(const uint8_t *up, const uint8_t *cur,
+		const uint8_t *down, uint8_t *out, const int width, const int odd,
+		const int bpp, const int ro, const int offset)
+{
+	int x;
+	const lnt_v16qi inc = lnt_splat8(offset > 0 ? offset : 0);
+	const lnt_v16qi dec = lnt_splat8(offset < 0 ? -offset : 0);
+	const lnt_v8hi m = { 0, -1, 0, -1, 0, -1, 0, -1 };
+
+	// The last pixel of the row is always left to the scalar code
+	for (x=1; x+LNT_SIMD_VL<width; x+=LNT_SIMD_VL) {
+		lnt_bayer_block(up, cur, down, out, x, odd, bpp, ro, inc, dec, m);
+		out += LNT_SIMD_VL * bpp;
+	}
+
+	return x - 1;
+}
+
+
+/**
+ * @brief Demosaic the interior of a row (vector version)
+ *
+ * Handles the pixels 1 to n of the row, where n is the returned value.
+ * The scalar code does the rest.
+ *
+ * @param up Previous source row
+ * @param cur Current source row
+ * @param down Next source row
+ * @param out Output of the pixel 1 of the row
+ * @param width Width of the row
+ * @param odd Odd row (BGBG) if not 0
+ * @param bpp Bytes per output pixel (3 or 4)
+ * @param bgr Blue first if not 0
+ * @param offset Brightness offset, see linect_set_brightness
+ *
+ * @returns Number of pixels written
+ */
+int LNT_SIMD_NAME(linect_bayer_row)(const uint8_t *up, const uint8_t *cur,
+		const uint8_t *down, uint8_t *out, int width, int odd, int bpp, int bgr,
+		int offset)
+{
+	if (bpp == 4) {
+		if (!bgr)
+			return odd ? lnt_bayer_row(up, cur, down, out, width, 1, 4, 0, offset)
+				: lnt_bayer_row(up, cur, down, out, width, 0, 4, 0, offset);
+		else
+			return odd ? lnt_bayer_row(up, cur, down, out, width, 1, 4, 2, offset)
+				: lnt_bayer_row(up, cur, down, out, width, 0, 4, 2, offset);
+	}
+	else {
+		if (!bgr)
+			return odd ? lnt_bayer_row(up, cur, down, out, width, 1, 3, 0, offset)
+				: lnt_bayer_row(up, cur, down, out, width, 0, 3, 0, offset);
+		else
+			return odd ? lnt_bayer_row(up, cur, down, out, width, 1, 3, 2, offset)
+				: lnt_bayer_row(up, cur, down, out, width, 0, 3, 2, offset);
+	}
+}
+
+
+#ifdef LNT_SIMD_SHUFFLE
+
+/**
+ * @brief Unpack the depth stream (vector version)
+ *
+ * One 11 bytes block (8 pixels) is unpacked per step. The pixel j of a
+ * block starts at the bit s = (11 * j) % 8 of its first byte, so :
+ *
+ *   value = ((hi << s) & 0xffff) >> 5 | (lo << s) >> 13
+ *
+ * where hi is the 16 bits word of the two first bytes of the pixel and lo
+ * the third byte. The bytes are gathered with pshufb and the shift by s
+ * is done with a 16 bits multiply.
+ *
+ * Handles the blocks 0 to n-1, where n is the returned value. The last
+ * block is always left to the scalar code, so that the 16 bytes loads
+ * stay inside the source buffer.
+ *
+ * @param src Packed 11 bits data
+ * @param dst Depth values
+ * @param nblocks Number of blocks of 11 bytes
+ *
+ * @returns Number of blocks unpacked
+ */
+int LNT_SIMD_NAME(linect_depth_unpack)(const uint8_t *src, uint16_t *dst, int nblocks)
+{
+	int i;
+	lnt_v16qi v;
+	lnt_v8hi hi, lo;
+	const lnt_v16qi ihi = { 1, 0, 2, 1, 3, 2, 5, 4, 6, 5, 7, 6, 9, 8, 10, 9 };
+	const lnt_v16qi ilo = { 2, 2, 3, 3, 4, 4, 6, 6, 7, 7, 8, 8, 10, 10, 11, 11 };
+	const lnt_v8hi mul = { 1, 8, 64, 2, 16, 128, 4, 32 };
+
+	for (i=0; i+1<nblocks; i++) {
+		v = __builtin_ia32_loaddqu((const char *) src);
+
+		hi = (lnt_v8hi) __builtin_ia32_pshufb128(v, ihi);
+		lo = (lnt_v8hi) __builtin_ia32_pshufb128(v, ilo);
+
+		// lo holds the third byte twice : >> 8 leaves it once
+		lo = __builtin_ia32_psrlwi128(lo, 8);
+		hi = __builtin_ia32_psrlwi128(hi * mul, 5)
+			| __builtin_ia32_psrlwi128(lo * mul, 13);
+
+		__builtin_ia32_storedqu((char *) dst, (lnt_v16qi) hi);
+
+		src += 11;
+		dst += 8;
+	}
+
+	return i;
+}
+
+#endif
@@ -0,0 +1,412 @@
+/** 
+ * @file linect-sysfs.c
+ * @author Arturo Casal
+ * @date 2010
+ * @version v0.1
+ *
+ * @brief Driver for MS Kinect
+ *
+ * @note Copyright (C) Arturo Casal
+ *
+ * @par Licences
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/version.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/kref.h>
+#include <linux/mm.h>
+#include <linux/device.h>
+#include <linux/jiffies.h>
+#include <linux/math64.h>
+
+#include <linux/usb.h>
+#include <media/v4l2-common.h>
+#include <media/v4l2-ioctl.h>
+
+#include "linect.h"
+
+
+/** 
+ * @param vdev Video device
+ * @param dev Device structure
+ *
+ * @returns Isochronous stream of the video device
+ */
+static fnusb_isoc_stream * linect_sysfs_stream(struct video_device *vdev, struct usb_linect *dev)
+{
+	if (vdev == dev->cam->depth_vdev)
+		return &dev->cam->depth_isoc;
+
+	return &dev->cam->rgb_isoc;
+}
+
+
+/** 
+ * @param n Number of events
+ * @param ms Elapsed time in ms
+ *
+ * @returns Events per second
+ */
+static unsigned long linect_sysfs_rate(unsigned long n, unsigned int ms)
+{
+	if (ms == 0)
+		return 0;
+
+	return (unsigned long) div_u64((u64) n * 1000, ms);
+}
+
+
+/** 
+ * @param class Class device
+ * @param attr Device attribute
+ * @retval buf Adress of buffer with the 'isoc_xfers' value
+ *
+ * @returns Size of buffer
+ */
+static ssize_t show_isoc_xfers(struct device *class, struct device_attribute *attr, char *buf)
+{
+	struct video_device *vdev = to_video_device(class);
+	struct usb_linect *dev = video_get_drvdata(vdev);
+
+	return sprintf(buf, "%d\n", dev->cam->isoc_xfers);
+}
+
+
+/** 
+ * @param class Class device
+ * @param attr Device attribute
+ * @param buf Buffer with the new 'isoc_xfers' value
+ * @param count Size of buffer
+ *
+ * @returns Size of buffer
+ *
+ * @brief The value is used the next time a stream is started.
+ */
+static ssize_t store_isoc_xfers(struct device *class, struct device_attribute *attr,
+		const char *buf, size_t count)
+{
+	unsigned long value;
+
+	struct video_device *vdev = to_video_device(class);
+	struct usb_linect *dev = video_get_drvdata(vdev);
+
+	value = simple_strtoul(buf, NULL, 10);
+
+	if (value < 2 || value > MAX_XFERS)
+		return -EINVAL;
+
+	dev->cam->isoc_xfers = value;
+
+	if (dev->cam->isoc_batch > dev->cam->isoc_xfers / 2)
+		dev->cam->isoc_batch = dev->cam->isoc_xfers / 2;
+
+	return count;
+}
+
+
+/** 
+ * @param class Class device
+ * @param attr Device attribute
+ * @retval buf Adress of buffer with the 'isoc_pkts' value
+ *
+ * @returns Size of buffer
+ */
+static ssize_t show_isoc_pkts(struct device *class, struct device_attribute *attr, char *buf)
+{
+	struct video_device *vdev = to_video_device(class);
+	struct usb_linect *dev = video_get_drvdata(vdev);
+
+	return sprintf(buf, "%d\n", dev->cam->isoc_pkts);
+}
+
+
+/** 
+ * @param class Class device
+ * @param attr Device attribute
+ * @param buf Buffer with the new 'isoc_pkts' value
+ * @param count Size of buffer
+ *
+ * @returns Size of buffer
+ *
+ * @brief The value is used the next time a stream is started.
+ */
+static ssize_t store_isoc_pkts(struct device *class, struct device_attribute *attr,
+		const char *buf, size_t count)
+{
+	unsigned long value;
+
+	struct video_device *vdev = to_video_device(class);
+	struct usb_linect *dev = video_get_drvdata(vdev);
+
+	value = simple_strtoul(buf, NULL, 10);
+
+	if (value < 1 || value > MAX_PKTS_PER_XFER)
+		return -EINVAL;
+
+	dev->cam->isoc_pkts = value;
+
+	return count;
+}
+
+
+/** 
+ * @param class Class device
+ * @param attr Device attribute
+ * @retval buf Adress of buffer with the 'isoc_batch' value
+ *
+ * @returns Size of buffer
+ */
+static ssize_t show_isoc_batch(struct device *class, struct device_attribute *attr, char *buf)
+{
+	struct video_device *vdev = to_video_device(class);
+	struct usb_linect *dev = video_get_drvdata(vdev);
+
+	return sprintf(buf, "%d\n", dev->cam->isoc_batch);
+}
+
+
+/** 
+ * @param class Class device
+ * @param attr Device attribute
+ * @param buf Buffer with the new 'isoc_batch' value
+ * @param count Size of buffer
+ *
+ * @returns Size of buffer
+ *
+ * @brief The value is used the next time a stream is started.
+ *
+ * The URBs are resubmitted once the tasklet has processed them, so half of
+ * the ring at least must stay on the endpoint while a batch completes.
+ */
+static ssize_t store_isoc_batch(struct device *class, struct device_attribute *attr,
+		const char *buf, size_t count)
+{
+	unsigned long value;
+
+	struct video_device *vdev = to_video_device(class);
+	struct usb_linect *dev = video_get_drvdata(vdev);
+
+	value = simple_strtoul(buf, NULL, 10);
+
+	if (value < 1 || value > dev->cam->isoc_xfers / 2)
+		return -EINVAL;
+
+	dev->cam->isoc_batch = value;
+
+	return count;
+}
+
+
+/** 
+ * @param class Class device
+ * @param attr Device attribute
+ * @retval buf Adress of buffer with the stream statistics
+ *
+ * @returns Size of buffer
+ *
+ * @brief The rates are computed from the start of the stream to its last completion.
+ *
+ * "frames lost" counts the frames that the tasklet had to discard because the
+ * conversion work still held every other buffer (the newest frame is lost).
+ * "frames skipped" counts the frames that the work released without
+ * conversion because a newer one was already there (the oldest are lost).
+ */
+static ssize_t show_isoc_stats(struct device *class, struct device_attribute *attr, char *buf)
+{
+	unsigned int ms;
+	unsigned long completions, interrupts;
+	struct linect_frame_ring *ring;
+	fnusb_isoc_stream *strm;
+
+	struct video_device *vdev = to_video_device(class);
+	struct usb_linect *dev = video_get_drvdata(vdev);
+
+	strm = linect_sysfs_stream(vdev, dev);
+	ring = (vdev == dev->cam->depth_vdev) ? &dev->cam->frame_ring_depth : &dev->cam->frame_ring;
+
+	completions = strm->completions;
+	interrupts = strm->interrupts;
+	ms = jiffies_to_msecs(strm->last - strm->start);
+
+	return sprintf(buf,
+			"urbs: %d\n"
+			"packets per urb: %d\n"
+			"urbs per interrupt: %d\n"
+			"completions: %lu\n"
+			"interrupts: %lu\n"
+			"completions/s: %lu\n"
+			"interrupts/s: %lu\n"
+			"packets/s: %lu\n"
+			"frames: %u\n"
+			"frames lost: %u\n"
+			"frames skipped: %u\n",
+			strm->num_xfers, strm->pkts, strm->batch,
+			completions, interrupts,
+			linect_sysfs_rate(completions, ms),
+			linect_sysfs_rate(interrupts, ms),
+			linect_sysfs_rate(completions * strm->pkts, ms),
+			ring->head, ring->lost, ring->skipped);
+}
+
+
+/** 
+ * @param class Class device
+ * @param attr Device attribute
+ * @retval buf Adress of buffer with the 'sync_tolerance' value
+ *
+ * @returns Size of buffer
+ */
+static ssize_t show_sync_tolerance(struct device *class, struct device_attribute *attr, char *buf)
+{
+	struct video_device *vdev = to_video_device(class);
+	struct usb_linect *dev = video_get_drvdata(vdev);
+
+	return sprintf(buf, "%u\n", dev->cam->sync.tolerance);
+}
+
+
+/** 
+ * @param class Class device
+ * @param attr Device attribute
+ * @param buf Buffer with the new 'sync_tolerance' value
+ * @param count Size of buffer
+ *
+ * @returns Size of buffer
+ *
+ * @brief The value is in device ticks, 0 disables the pairing. The statistics are cleared.
+ */
+static ssize_t store_sync_tolerance(struct device *class, struct device_attribute *attr,
+		const char *buf, size_t count)
+{
+	unsigned long value;
+
+	struct video_device *vdev = to_video_device(class);
+	struct usb_linect *dev = video_get_drvdata(vdev);
+
+	value = simple_strtoul(buf, NULL, 10);
+
+	if (value > INT_MAX)
+		return -EINVAL;
+
+	linect_sync_init(dev, value);
+
+	return count;
+}
+
+
+/** 
+ * @param class Class device
+ * @param attr Device attribute
+ * @retval buf Adress of buffer with the pairing statistics
+ *
+ * @returns Size of buffer
+ *
+ * @brief The skews are the depth timestamp minus the RGB timestamp, in device ticks.
+ */
+static ssize_t show_sync_stats(struct device *class, struct device_attribute *attr, char *buf)
+{
+	unsigned long flags;
+	unsigned long pairs, unpaired_rgb, unpaired_depth;
+	int skew, skew_min, skew_max;
+	u64 skew_sum;
+
+	struct video_device *vdev = to_video_device(class);
+	struct usb_linect *dev = video_get_drvdata(vdev);
+	struct linect_sync *sync = &dev->cam->sync;
+
+	spin_lock_irqsave(&sync->lock, flags);
+	pairs = sync->pairs;
+	unpaired_rgb = sync->unpaired[LNT_SYNC_RGB];
+	unpaired_depth = sync->unpaired[LNT_SYNC_DEPTH];
+	skew = sync->skew;
+	skew_min = sync->skew_min;
+	skew_max = sync->skew_max;
+	skew_sum = sync->skew_sum;
+	spin_unlock_irqrestore(&sync->lock, flags);
+
+	return sprintf(buf,
+			"pairs: %lu\n"
+			"unpaired rgb: %lu\n"
+			"unpaired depth: %lu\n"
+			"skew: %d\n"
+			"skew min: %d\n"
+			"skew max: %d\n"
+			"skew mean (absolute): %llu\n",
+			pairs, unpaired_rgb, unpaired_depth,
+			skew, skew_min, skew_max,
+			(unsigned long long) (pairs ? div64_u64(skew_sum, pairs) : 0));
+}
+
+
+static DEVICE_ATTR(isoc_xfers, S_IRUGO | S_IWUSR, show_isoc_xfers, store_isoc_xfers);
+static DEVICE_ATTR(isoc_pkts, S_IRUGO | S_IWUSR, show_isoc_pkts, store_isoc_pkts);
+static DEVICE_ATTR(isoc_batch, S_IRUGO | S_IWUSR, show_isoc_batch, store_isoc_batch);
+static DEVICE_ATTR(isoc_stats, S_IRUGO, show_isoc_stats, NULL);
+static DEVICE_ATTR(sync_tolerance, S_IRUGO | S_IWUSR, show_sync_tolerance, store_sync_tolerance);
+static DEVICE_ATTR(sync_stats, S_IRUGO, show_sync_stats, NULL);
+
+
+/** 
+ * @param vdev Video device structure
+ *
+ * @returns 0 if all is OK
+ *
+ * @brief Create the 'sys' entries.
+ *
+ * This function permits to create all the entries in the 'sys' filesystem.
+ */
+int linect_create_sysfs_files(struct video_device *vdev)
+{
+	int ret;
+
+	ret = device_create_file(&vdev->dev, &dev_attr_isoc_xfers);
+	if (ret == 0)
+		ret = device_create_file(&vdev->dev, &dev_attr_isoc_pkts);
+	if (ret == 0)
+		ret = device_create_file(&vdev->dev, &dev_attr_isoc_batch);
+	if (ret == 0)
+		ret = device_create_file(&vdev->dev, &dev_attr_isoc_stats);
+	if (ret == 0)
+		ret = device_create_file(&vdev->dev, &dev_attr_sync_tolerance);
+	if (ret == 0)
+		ret = device_create_file(&vdev->dev, &dev_attr_sync_stats);
+
+	return ret;
+}
+
+
+/** 
+ * @param vdev Video device structure
+ *
+ * @brief Remove the 'sys' entries.
+ *
+ * This function permits to remove all the entries in the 'sys' filesystem.
+ */
+void linect_remove_sysfs_files(struct video_device *vdev)
+{
+	device_remove_file(&vdev->dev, &dev_attr_isoc_xfers);
+	device_remove_file(&vdev->dev, &dev_attr_isoc_pkts);
+	device_remove_file(&vdev->dev, &dev_attr_isoc_batch);
+	device_remove_file(&vdev->dev, &dev_attr_isoc_stats);
+	device_remove_file(&vdev->dev, &dev_attr_sync_tolerance);
+	device_remove_file(&vdev->dev, &dev_attr_sync_stats);
+}
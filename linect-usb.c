@@ -34,6 +34,8 @@
 #include <linux/slab.h>
 #include <linux/kref.h>
 #include <linux/mm.h>
+#include <linux/interrupt.h>
+#include <linux/workqueue.h>
 
 #include <linux/usb.h>
 #include <media/v4l2-common.h>
@@ -43,10 +45,21 @@
 
 #include "linect.h"
 
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,35)
+#define usb_alloc_coherent usb_buffer_alloc
+#define usb_free_coherent usb_buffer_free
+#endif
+
+
 /* Module params */
 static int freemotor = 0;
 static int freeled = 0;
 static int startupinit = 0;
+static int isoc_xfers = NUM_XFERS;
+static int isoc_pkts = PKTS_PER_XFER;
+static int isoc_batch = 1;
+static int sync_tolerance = 0;
 
 
 // Index of Kinect device
@@ -78,33 +91,65 @@ MODULE_DEVICE_TABLE(usb, linect_table);		/**< Define the supported devices */
 
 /* LINECT functs */
 
-int fnusb_start_iso(struct usb_linect *dev, fnusb_isoc_stream *strm, int ep, int xfers, int pkts, int len)
+int fnusb_start_iso(struct usb_linect *dev, fnusb_isoc_stream *strm, int ep, int xfers, int pkts, int len, int batch)
 {
 	int ret, i, j;
 	struct urb *urb;
-	uint8_t *bufp;
 	
 	strm->dev = dev;
 	strm->num_xfers = xfers;
 	strm->pkts = pkts;
 	strm->len = len;
-	//strm->buffer = linect_rvmalloc(xfers * pkts * len);
-	strm->buffer = kzalloc(xfers * pkts * len, GFP_KERNEL);
+	strm->batch = batch;
+	strm->completions = 0;
+	strm->interrupts = 0;
+	strm->start = jiffies;
+	strm->last = strm->start;
 	strm->xfers = kzalloc(sizeof(struct urb*) * xfers, GFP_KERNEL);
+	strm->done = kzalloc(sizeof(struct urb*) * xfers, GFP_KERNEL);
+	strm->done_head = 0;
+	strm->done_count = 0;
+	strm->stopping = 0;
 
-	bufp = strm->buffer;
+	if (strm->xfers == NULL || strm->done == NULL) {
+		LNT_ERROR("Out of memory !\n");
+		goto error;
+	}
 
+	spin_lock_init(&strm->lock);
+	tasklet_init(&strm->tasklet, usb_linect_isoc_tasklet, (unsigned long) strm);
+
+	// All the transfers are allocated before the first one is submitted
 	for (i=0; i<xfers; i++) {
 		LNT_DEBUG("Creating EP %02x transfer #%d\n", ep, i);
-		strm->xfers[i] = usb_alloc_urb(pkts, GFP_KERNEL);
-		
-		urb = strm->xfers[i];
+		urb = usb_alloc_urb(pkts, GFP_KERNEL);
+
+		if (urb == NULL) {
+			LNT_ERROR("Failed to allocate transfer #%d\n", i);
+			goto error;
+		}
+
+		// Coherent buffer, no DMA mapping at each submission
+		urb->transfer_buffer = usb_alloc_coherent(dev->cam->udev, pkts*len, GFP_KERNEL, &urb->transfer_dma);
+
+		if (urb->transfer_buffer == NULL) {
+			LNT_ERROR("Failed to allocate the buffer of transfer #%d\n", i);
+			usb_free_urb(urb);
+			goto error;
+		}
+
+		strm->xfers[i] = urb;
 
 		urb->interval = 1; 
 		urb->dev = dev->cam->udev;
 		urb->pipe = usb_rcvisocpipe(dev->cam->udev, ep);
-		urb->transfer_flags = URB_ISO_ASAP;
-		urb->transfer_buffer = bufp;
+		urb->transfer_flags = URB_ISO_ASAP | URB_NO_TRANSFER_DMA_MAP;
+
+		// Only the last URB of a batch, and the last URB of the ring, raise
+		// the completion interrupt
+		if ((i + 1) % batch && i != xfers - 1)
+			urb->transfer_flags |= URB_NO_INTERRUPT;
+
 		urb->transfer_buffer_length = pkts*len;
 		urb->complete = usb_linect_isoc_handler;
 		urb->context = strm;
@@ -115,7 +160,9 @@ int fnusb_start_iso(struct usb_linect *dev, fnusb_isoc_stream *strm, int ep, int
 			urb->iso_frame_desc[j].offset = j * len;
 			urb->iso_frame_desc[j].length = len;
 		}
+	}
 
+	for (i=0; i<xfers; i++) {
 		ret = usb_submit_urb(strm->xfers[i], GFP_KERNEL);
 
 		if (ret)
@@ -149,12 +196,60 @@ int fnusb_start_iso(struct usb_linect *dev, fnusb_isoc_stream *strm, int ep, int
 				LNT_ERROR("EMSGSIZE\n");
 				break;
 		}
-
-		bufp += pkts*len;
 	}
 
 	return 0;
 
+error:
+	if (strm->xfers != NULL) {
+		for (i=0; i<xfers; i++) {
+			urb = strm->xfers[i];
+
+			if (urb != NULL) {
+				usb_free_coherent(dev->cam->udev, urb->transfer_buffer_length,
+						urb->transfer_buffer, urb->transfer_dma);
+				usb_free_urb(urb);
+			}
+		}
+	}
+
+	kfree(strm->xfers);
+	kfree(strm->done);
+	strm->xfers = NULL;
+	strm->done = NULL;
+
+	return -ENOMEM;
+}
+
+/** 
+ * @param dev Device structure
+ *
+ * @brief Set the packet geometry of a stream.
+ *
+ * The frame buffers are sized from it: pkts_per_frame * pkt_size bytes.
+ */
+void linect_depth_stream_geometry(struct usb_linect *dev)
+{
+	if (dev->cam->depth_format == LNT_DEPTH_10BIT)
+		dev->cam->depth_stream.pkts_per_frame = DEPTH_10_PKTS_PER_FRAME;
+	else
+		dev->cam->depth_stream.pkts_per_frame = DEPTH_PKTS_PER_FRAME;
+
+	dev->cam->depth_stream.pkt_size = DEPTH_PKTDSIZE;
+}
+
+void linect_rgb_stream_geometry(struct usb_linect *dev)
+{
+	if (dev->cam->rgb_format == LNT_RGB_UYVY)
+		dev->cam->rgb_stream.pkts_per_frame = RGB_YUV_PKTS_PER_FRAME;
+	else if (dev->cam->rgb_format == LNT_RGB_BAYER_HR)
+		dev->cam->rgb_stream.pkts_per_frame = RGB_HR_PKTS_PER_FRAME;
+	else if (dev->cam->rgb_format == LNT_RGB_IR)
+		dev->cam->rgb_stream.pkts_per_frame = RGB_IR_PKTS_PER_FRAME;
+	else
+		dev->cam->rgb_stream.pkts_per_frame = RGB_PKTS_PER_FRAME;
+
+	dev->cam->rgb_stream.pkt_size = RGB_PKTDSIZE;
 }
 
 int linect_start_depth(struct usb_linect *dev)
@@ -162,14 +257,14 @@ int linect_start_depth(struct usb_linect *dev)
 	int res;
 	
 	dev->cam->depth_stream.dev = dev;
-	dev->cam->depth_stream.pkts_per_frame = DEPTH_PKTS_PER_FRAME;
-	dev->cam->depth_stream.pkt_size = DEPTH_PKTDSIZE;
+	linect_depth_stream_geometry(dev);
 	dev->cam->depth_stream.synced = 0;
 	dev->cam->depth_stream.flag = 0x70;
 	
 	dev->cam->depth_isoc.type = ISOC_DEPTH;
 
-	res = fnusb_start_iso(dev, &dev->cam->depth_isoc, 0x82, NUM_XFERS, PKTS_PER_XFER, DEPTH_PKTBUF);
+	res = fnusb_start_iso(dev, &dev->cam->depth_isoc, 0x82,
+			dev->cam->isoc_xfers, dev->cam->isoc_pkts, DEPTH_PKTBUF, dev->cam->isoc_batch);
 	
 	if (res) return res;
 	
@@ -183,14 +278,14 @@ int linect_start_rgb(struct usb_linect *dev)
 	int res;
 	
 	dev->cam->rgb_stream.dev = dev;
-	dev->cam->rgb_stream.pkts_per_frame = RGB_PKTS_PER_FRAME;
-	dev->cam->rgb_stream.pkt_size = RGB_PKTDSIZE;
+	linect_rgb_stream_geometry(dev);
 	dev->cam->rgb_stream.synced = 0;
 	dev->cam->rgb_stream.flag = 0x80;
 	
 	dev->cam->rgb_isoc.type = ISOC_RGB;
 
-	res = fnusb_start_iso(dev, &dev->cam->rgb_isoc, 0x81, NUM_XFERS, PKTS_PER_XFER, RGB_PKTBUF);
+	res = fnusb_start_iso(dev, &dev->cam->rgb_isoc, 0x81,
+			dev->cam->isoc_xfers, dev->cam->isoc_pkts, RGB_PKTBUF, dev->cam->isoc_batch);
 	
 	if (res) return res;
 	
@@ -211,6 +306,7 @@ int linect_start_rgb(struct usb_linect *dev)
  */
 int usb_linect_rgb_isoc_init(struct usb_linect *dev)
 {
+	int err;
 
 	if (dev == NULL)
 		return -EFAULT;
@@ -220,11 +316,38 @@ int usb_linect_rgb_isoc_init(struct usb_linect *dev)
 
 
 	LNT_DEBUG("usb_linect_isoc_init() rgb\n");
+
+	// The camera converts to UYVY itself, at 15 Hz. A camera set up on
+	// startup keeps its 640x480 Bayer mode.
+	if (dev->cam->startupinit)
+		dev->cam->rgb_format = LNT_RGB_BAYER;
+	else if (dev->cam->vsettings.palette == LNT_PALETTE_UYVY)
+		dev->cam->rgb_format = LNT_RGB_UYVY;
+	else if (dev->cam->vsettings.palette == LNT_PALETTE_IR8 ||
+			dev->cam->vsettings.palette == LNT_PALETTE_IR16)
+		dev->cam->rgb_format = LNT_RGB_IR;
+	else if (dev->cam->image.x == 1280)
+		dev->cam->rgb_format = LNT_RGB_BAYER_HR;
+	else
+		dev->cam->rgb_format = LNT_RGB_BAYER;
+
+	// The frames are sized for the packets of the selected mode
+	linect_rgb_stream_geometry(dev);
+
+	err = linect_set_rgb_frame_len(dev, dev->cam->rgb_stream.pkts_per_frame * dev->cam->rgb_stream.pkt_size);
+
+	if (err)
+		return err;
 	
 	linect_cam_start_rgb(dev);
 	mutex_lock(&dev->cam->mutex_cam);
-	linect_start_rgb(dev);
+	err = linect_start_rgb(dev);
 	mutex_unlock(&dev->cam->mutex_cam);
+
+	if (err) {
+		linect_cam_stop_rgb(dev);
+		return err;
+	}
 	
 		
 	// DEPTH
@@ -234,6 +357,7 @@ int usb_linect_rgb_isoc_init(struct usb_linect *dev)
 
 int usb_linect_depth_isoc_init(struct usb_linect *dev)
 {
+	int err;
 
 	if (dev == NULL)
 		return -EFAULT;
@@ -243,14 +367,27 @@ int usb_linect_depth_isoc_init(struct usb_linect *dev)
 
 
 	LNT_DEBUG("usb_linect_isoc_init() depth\n");
+
+	// A camera set up on startup keeps its 11 bits mode
+	if (!dev->cam->startupinit &&
+			(dev->cam->depth_vsettings.palette == LNT_PALETTE_DEPTH10PACKED ||
+			 dev->cam->depth_vsettings.palette == LNT_PALETTE_DEPTH10))
+		dev->cam->depth_format = LNT_DEPTH_10BIT;
+	else
+		dev->cam->depth_format = LNT_DEPTH_11BIT;
 	
 	
 	
 	linect_cam_start_depth(dev);
 	mutex_lock(&dev->cam->mutex_cam);
-	linect_start_depth(dev);
+	err = linect_start_depth(dev);
 	mutex_unlock(&dev->cam->mutex_cam);
 
+	if (err) {
+		linect_cam_stop_depth(dev);
+		return err;
+	}
+
 	return 0;
 }
 
@@ -363,13 +500,12 @@ int stream_process(packet_stream *strm, uint8_t *buf, uint8_t *pkt, int len)
 /** 
  * @param urb URB structure
  *
- * @brief ISOC handler
+ * @brief ISOC processing
  *
- * This function is called as an URB transfert is complete (Isochronous pipe).
- * So, the traitement is done in interrupt time, so it has be fast, not crash,
- * ans not stall. Neat.
+ * This function reassembles the packets of a completed URB into the frame
+ * buffer, then submits the URB again. It runs in the stream tasklet.
  */
-void usb_linect_isoc_handler(struct urb *urb)
+static void usb_linect_isoc_process(struct urb *urb)
 {
 	int i;
 	int ret;
@@ -490,6 +626,8 @@ void usb_linect_isoc_handler(struct urb *urb)
 			if (isoc_stream->type == ISOC_RGB) {
 				got_frame = stream_process(&dev->cam->rgb_stream, fill, iso_buf, framelen);
 				if (got_frame) {
+					framebuf->timestamp = dev->cam->rgb_stream.timestamp;
+
 					// If there are errors, we skip a frame...
 					if (linect_next_rgb_frame(dev))
 						dev->cam->vframes_dumped++;
@@ -506,6 +644,8 @@ void usb_linect_isoc_handler(struct urb *urb)
 				// DEPTH
 				got_frame = stream_process(&dev->cam->depth_stream, fill, iso_buf, framelen);
 				if (got_frame) {
+					framebuf->timestamp = dev->cam->depth_stream.timestamp;
+
 					// If there are errors, we skip a frame...
 					if (linect_next_depth_frame(dev))
 						dev->cam->vframes_dumped++;
@@ -525,12 +665,12 @@ void usb_linect_isoc_handler(struct urb *urb)
 		}
 	}
 
+	// The conversion work wakes up the readers
 	if (awake == 1) {
 		if (isoc_stream->type == ISOC_RGB)
-			wake_up_interruptible(&dev->cam->wait_rgb_frame);
+			queue_work(dev->cam->workqueue, &dev->cam->rgb_work);
 		else
-			wake_up_interruptible(&dev->cam->wait_depth_frame);
-		
+			queue_work(dev->cam->workqueue, &dev->cam->depth_work);
 	}
 
 	urb->dev = dev->cam->udev;
@@ -541,12 +681,80 @@ void usb_linect_isoc_handler(struct urb *urb)
 	}
 }
 
+/** 
+ * @param data Isochronous stream
+ *
+ * @brief ISOC tasklet
+ *
+ * This function processes the completed URBs of a stream in completion order.
+ */
+void usb_linect_isoc_tasklet(unsigned long data)
+{
+	struct urb *urb;
+	unsigned long flags;
+	fnusb_isoc_stream *strm = (fnusb_isoc_stream *) data;
+
+	spin_lock_irqsave(&strm->lock, flags);
+
+	while (strm->done_count > 0 && !strm->stopping) {
+		urb = strm->done[strm->done_head];
+		strm->done_head = (strm->done_head + 1) % strm->num_xfers;
+		strm->done_count--;
+
+		spin_unlock_irqrestore(&strm->lock, flags);
+		usb_linect_isoc_process(urb);
+		spin_lock_irqsave(&strm->lock, flags);
+	}
+
+	spin_unlock_irqrestore(&strm->lock, flags);
+}
+
+
+/** 
+ * @param urb URB structure
+ *
+ * @brief ISOC handler
+ *
+ * This function is called as an URB transfert is complete (Isochronous pipe).
+ * It runs in interrupt time, so it only queues the URB and schedules the
+ * stream tasklet. The packets are copied and the URB is submitted again there.
+ */
+void usb_linect_isoc_handler(struct urb *urb)
+{
+	unsigned long flags;
+	fnusb_isoc_stream *strm = (fnusb_isoc_stream *) urb->context;
+
+	spin_lock_irqsave(&strm->lock, flags);
+
+	strm->completions++;
+	strm->last = jiffies;
+
+	if (!(urb->transfer_flags & URB_NO_INTERRUPT))
+		strm->interrupts++;
+
+	if (!strm->stopping) {
+		strm->done[(strm->done_head + strm->done_count) % strm->num_xfers] = urb;
+		strm->done_count++;
+		tasklet_schedule(&strm->tasklet);
+	}
+
+	spin_unlock_irqrestore(&strm->lock, flags);
+}
+
 /* Kinect ISOC cleanup*/
 
+
 int linect_isoc_depth_cleanup(struct usb_linect *dev)
 {
 	struct urb *urb;
 	int i;
+
+	// Stop the reassembly before killing the URBs
+	spin_lock_irq(&dev->cam->depth_isoc.lock);
+	dev->cam->depth_isoc.stopping = 1;
+	spin_unlock_irq(&dev->cam->depth_isoc.lock);
+	tasklet_kill(&dev->cam->depth_isoc.tasklet);
+
 	for (i=0; i<dev->cam->depth_isoc.num_xfers; i++) {
 	
 
@@ -557,14 +765,14 @@ int linect_isoc_depth_cleanup(struct usb_linect *dev)
 				usb_kill_urb(urb);
 			}
 			
+			usb_free_coherent(dev->cam->udev, urb->transfer_buffer_length,
+					urb->transfer_buffer, urb->transfer_dma);
 			usb_free_urb(urb);
 			dev->cam->depth_isoc.xfers[i] = NULL;
 		}
 	}
-	//linect_rvfree(dev->cam->depth_isoc.buffer, dev->cam->depth_isoc.num_xfers * dev->cam->depth_isoc.pkts * dev->cam->depth_isoc.len);
-	kfree(dev->cam->depth_isoc.buffer);
-	
 	kfree(dev->cam->depth_isoc.xfers);
+	kfree(dev->cam->depth_isoc.done);
 	return 0;
 }
 
@@ -572,6 +780,13 @@ int linect_isoc_rgb_cleanup(struct usb_linect *dev)
 {
 	struct urb *urb;
 	int i;
+
+	// Stop the reassembly before killing the URBs
+	spin_lock_irq(&dev->cam->rgb_isoc.lock);
+	dev->cam->rgb_isoc.stopping = 1;
+	spin_unlock_irq(&dev->cam->rgb_isoc.lock);
+	tasklet_kill(&dev->cam->rgb_isoc.tasklet);
+
 	for (i=0; i<dev->cam->rgb_isoc.num_xfers; i++) {
 	
 
@@ -582,13 +797,14 @@ int linect_isoc_rgb_cleanup(struct usb_linect *dev)
 				usb_kill_urb(urb);
 			}
 			
+			usb_free_coherent(dev->cam->udev, urb->transfer_buffer_length,
+					urb->transfer_buffer, urb->transfer_dma);
 			usb_free_urb(urb);
 			dev->cam->rgb_isoc.xfers[i] = NULL;
 		}
 	}
-	//linect_rvfree(dev->cam->rgb_isoc.buffer, dev->cam->rgb_isoc.num_xfers * dev->cam->rgb_isoc.pkts * dev->cam->rgb_isoc.len);
-	kfree(dev->cam->rgb_isoc.buffer);
 	kfree(dev->cam->rgb_isoc.xfers);
+	kfree(dev->cam->rgb_isoc.done);
 	return 0;
 }
 
@@ -615,6 +831,9 @@ void usb_linect_rgb_isoc_cleanup(struct usb_linect *dev)
 	linect_isoc_rgb_cleanup(dev);
 	mutex_unlock(&dev->cam->mutex_cam);
 	linect_cam_stop_rgb(dev);
+
+	// Wait for the conversion in progress
+	cancel_work_sync(&dev->cam->rgb_work);
 	
 	// DEPTH
 
@@ -639,6 +858,9 @@ void usb_linect_depth_isoc_cleanup(struct usb_linect *dev)
 	mutex_unlock(&dev->cam->mutex_cam);
 	linect_cam_stop_depth(dev);
 
+	// Wait for the conversion in progress
+	cancel_work_sync(&dev->cam->depth_work);
+
 	// All is done
 	dev->cam->depth_isoc_init_ok = 0;
 }
@@ -663,6 +885,8 @@ static int usb_linect_default_settings(struct usb_linect *dev)
 	dev->cam->depth_vsettings.palette = LNT_PALETTE_RGB24;
 	dev->cam->depth_vsettings.depth = 24;
 	dev->cam->depth_vsettings.brightness = 0x7f00;
+
+	linect_set_brightness(dev);
 	
 	dev->cam->cam_tag = 0;
 
@@ -781,7 +1005,8 @@ static int usb_linect_probe(struct usb_interface *interface, const struct usb_de
 	
 	if (dev->cam == NULL) {
 		LNT_ERROR("Out of memory !\n");
-		return -ENOMEM;
+		err = -ENOMEM;
+		goto error;
 	}
 
 	// Init mutexes, spinlock, etc.
@@ -793,9 +1018,23 @@ static int usb_linect_probe(struct usb_interface *interface, const struct usb_de
 	mutex_init(&dev->cam->modlock_depth);
 	spin_lock_init(&dev->cam->spinlock_rgb);
 	spin_lock_init(&dev->cam->spinlock_depth);
+	spin_lock_init(&dev->cam->sync.lock);
 	init_waitqueue_head(&dev->cam->wait_rgb_frame);
 	init_waitqueue_head(&dev->cam->wait_depth_frame);
 
+	// Frame conversion workqueue
+	dev->cam->dev = dev;
+	dev->cam->workqueue = create_singlethread_workqueue(DRIVER_NAME);
+
+	if (dev->cam->workqueue == NULL) {
+		LNT_ERROR("Failed to create the workqueue !\n");
+		err = -ENOMEM;
+		goto error_cam;
+	}
+
+	INIT_WORK(&dev->cam->rgb_work, linect_rgb_work);
+	INIT_WORK(&dev->cam->depth_work, linect_depth_work);
+
 	// Save pointers
 	dev->cam->webcam_model = webcam_model;
 	dev->cam->udev = udev;
@@ -831,6 +1070,10 @@ static int usb_linect_probe(struct usb_interface *interface, const struct usb_de
 	dev->freemotor = freemotor ? 1 : 0;
 	dev->freeled = freeled ? 1 : 0;
 	dev->cam->startupinit = startupinit ? 1 : 0;
+	dev->cam->isoc_xfers = clamp(isoc_xfers, 2, MAX_XFERS);
+	dev->cam->isoc_pkts = clamp(isoc_pkts, 1, MAX_PKTS_PER_XFER);
+	dev->cam->isoc_batch = clamp(isoc_batch, 1, dev->cam->isoc_xfers / 2);
+	linect_sync_init(dev, max(sync_tolerance, 0));
 	
 	dev->type = KNT_TYPE_CAM;
 	
@@ -848,14 +1091,9 @@ static int usb_linect_probe(struct usb_interface *interface, const struct usb_de
 	dev->cam->vdev = video_device_alloc();
 	dev->cam->depth_vdev = video_device_alloc();
 
-	if (!dev->cam->vdev) {
-		kfree(dev);
-		return -ENOMEM;
-	}
-	
-	if (!dev->cam->depth_vdev) {
-		kfree(dev);
-		return -ENOMEM;
+	if (dev->cam->vdev == NULL || dev->cam->depth_vdev == NULL) {
+		err = -ENOMEM;
+		goto error_vdev;
 	}
 
 	// Initialize the camera
@@ -864,17 +1102,13 @@ static int usb_linect_probe(struct usb_interface *interface, const struct usb_de
 	// Register the video device
 	err = v4l_linect_register_rgb_video_device(dev);
 
-	if (err) {
-		kfree(dev);
-		return err;
-	}
+	if (err)
+		goto error_vdev;
 	
 	err = v4l_linect_register_depth_video_device(dev);
 
-	if (err) {
-		kfree(dev);
-		return err;
-	}
+	if (err)
+		goto error_register;
 
 	// Save our data pointer in this interface device
 	usb_set_intfdata(interface, dev);
@@ -882,7 +1116,29 @@ static int usb_linect_probe(struct usb_interface *interface, const struct usb_de
 	// Default settings video device
 	usb_linect_default_settings(dev);
 
+	// Buffers are kept across opens. Nothing can fail from here, so the
+	// shrinker never sees a device freed by the error path.
+	linect_pool_add(dev);
+
 	return 0;
+
+error_register:
+	// The release callback frees the video device
+	v4l_linect_unregister_rgb_video_device(dev);
+	dev->cam->vdev = NULL;
+error_vdev:
+	if (dev->cam->vdev != NULL)
+		video_device_release(dev->cam->vdev);
+	if (dev->cam->depth_vdev != NULL)
+		video_device_release(dev->cam->depth_vdev);
+
+	destroy_workqueue(dev->cam->workqueue);
+error_cam:
+	kfree(dev->cam);
+error:
+	kfree(dev);
+
+	return err;
 }
 
 
@@ -923,6 +1179,11 @@ static void usb_linect_disconnect(struct usb_interface *interface)
 		// Unregister the video device
 		v4l_linect_unregister_rgb_video_device(dev);
 		v4l_linect_unregister_depth_video_device(dev);
+
+		// Release the kept buffers
+		linect_pool_del(dev);
+
+		destroy_workqueue(dev->cam->workqueue);
 	
 	} else {
 		LNT_INFO("Kinect motor disconnected.\n");
@@ -962,6 +1223,10 @@ static struct usb_driver usb_linect_driver = {
 module_param(freemotor, int, 0444);
 module_param(freeled, int, 0444);
 module_param(startupinit, int, 0444);
+module_param(isoc_xfers, int, 0444);
+module_param(isoc_pkts, int, 0444);
+module_param(isoc_batch, int, 0444);
+module_param(sync_tolerance, int, 0444);
 
 
 /** 
@@ -982,6 +1247,12 @@ static int __init usb_linect_init(void)
 	mutex_init(&modlock_tmpmotor);
 	mutex_init(&modlock_proc);
 
+	// Select the decoders
+	linect_bayer_init();
+
+	// Buffer pool shrinker
+	linect_pool_init();
+
 	// Register the driver with the USB subsystem
 	result = usb_register(&usb_linect_driver);
 
@@ -1005,6 +1276,8 @@ static void __exit usb_linect_exit(void)
 
 	// Deregister this driver with the USB subsystem
 	usb_deregister(&usb_linect_driver);
+
+	linect_pool_exit();
 }
 
 
@@ -1015,6 +1288,10 @@ module_exit(usb_linect_exit);
 MODULE_PARM_DESC(freemotor, "Driver does not move the motor, but offers interface.");
 MODULE_PARM_DESC(freeled, "Driver does not manage the led, but offers interface.");
 MODULE_PARM_DESC(startupinit, "Initialize Kinect device on startup.");
+MODULE_PARM_DESC(isoc_xfers, "Number of isochronous URBs per stream (2-64).");
+MODULE_PARM_DESC(isoc_pkts, "Number of packets per isochronous URB (1-64).");
+MODULE_PARM_DESC(isoc_batch, "Number of URBs per completion interrupt (at most half of isoc_xfers).");
+MODULE_PARM_DESC(sync_tolerance, "Maximal skew of paired RGB and depth images, in device ticks (0: no pairing).");
 
 
 MODULE_LICENSE("GPL");
@@ -125,6 +125,32 @@ static struct v4l2_queryctrl linect_depth_controls[] = {
 };
 
 
+/** 
+ * @param bayer Bayer stream asked
+ * @param width Width of wished resolution
+ * @param height Height of wished resolution
+ *
+ * @returns 1 if the RGB camera runs at 1280x1024, 0 for 640x480
+ */
+static int v4l_linect_rgb_hires(int bayer, int width, int height)
+{
+	// The camera sends 1280x1024 in Bayer only
+	return bayer && width >= 1280 && height >= 1024;
+}
+
+
+/** 
+ * @param palette Palette of the RGB node
+ *
+ * @returns 1 if the palette is converted from the Bayer stream
+ */
+static int v4l_linect_rgb_bayer(int palette)
+{
+	return palette != LNT_PALETTE_UYVY &&
+		palette != LNT_PALETTE_IR8 && palette != LNT_PALETTE_IR16;
+}
+
+
 /** 
  * @param dev
  * @param width Width of wished resolution
@@ -138,11 +164,38 @@ static struct v4l2_queryctrl linect_depth_controls[] = {
  */
 int v4l_linect_select_video_mode(struct usb_linect *dev, int width, int height)
 {
-	dev->cam->view.x = 640;
-	dev->cam->view.y = 480;
+	int err;
+	unsigned int len;
+
+	if (v4l_linect_rgb_hires(v4l_linect_rgb_bayer(dev->cam->vsettings.palette), width, height)) {
+		width = 1280;
+		height = 1024;
+	}
+	else {
+		width = 640;
+		height = 480;
+	}
+
+	// Images are sized for the largest palette, 4 bytes per pixel
+	len = PAGE_ALIGN(4 * width * height);
+
+	if (len != dev->cam->len_per_image) {
+		err = linect_set_rgb_image_len(dev, len);
+
+		if (err)
+			return err;
+	}
 
-	dev->cam->image.x = 640;
-	dev->cam->image.y = 480;
+	// The IR image has 8 more rows, in 2 bytes per pixel at most
+	if (dev->cam->vsettings.palette == LNT_PALETTE_IR8 ||
+			dev->cam->vsettings.palette == LNT_PALETTE_IR16)
+		height = IR_FRAME_H;
+
+	dev->cam->view.x = width;
+	dev->cam->view.y = height;
+
+	dev->cam->image.x = width;
+	dev->cam->image.y = height;
 	dev->cam->frame_size = dev->cam->image.x * dev->cam->image.y;
 
 	switch (dev->cam->vsettings.palette) {
@@ -154,7 +207,7 @@ int v4l_linect_select_video_mode(struct usb_linect *dev, int width, int height)
 
 		case LNT_PALETTE_RGB32:
 		case LNT_PALETTE_BGR32:
-			dev->cam->view_size = 3 * dev->cam->view.x * dev->cam->view.y;
+			dev->cam->view_size = 4 * dev->cam->view.x * dev->cam->view.y;
 			dev->cam->image_size = 4 * dev->cam->frame_size;
 			break;
 
@@ -163,6 +216,17 @@ int v4l_linect_select_video_mode(struct usb_linect *dev, int width, int height)
 			dev->cam->view_size = 2 * dev->cam->view.x * dev->cam->view.y;
 			dev->cam->image_size = 2 * dev->cam->frame_size;
 			break;
+
+		case LNT_PALETTE_SGRBG8:
+		case LNT_PALETTE_IR8:
+			dev->cam->view_size = dev->cam->view.x * dev->cam->view.y;
+			dev->cam->image_size = dev->cam->frame_size;
+			break;
+
+		case LNT_PALETTE_IR16:
+			dev->cam->view_size = 2 * dev->cam->view.x * dev->cam->view.y;
+			dev->cam->image_size = 2 * dev->cam->frame_size;
+			break;
 	}
 	
 	dev->cam->view_depth.x = 640;
@@ -181,7 +245,7 @@ int v4l_linect_select_video_mode(struct usb_linect *dev, int width, int height)
 
 		case LNT_PALETTE_RGB32:
 		case LNT_PALETTE_BGR32:
-			dev->cam->view_size_depth = 3 * dev->cam->view_depth.x * dev->cam->view_depth.y;
+			dev->cam->view_size_depth = 4 * dev->cam->view_depth.x * dev->cam->view_depth.y;
 			dev->cam->image_size_depth = 4 * dev->cam->frame_size_depth;
 			break;
 
@@ -190,12 +254,94 @@ int v4l_linect_select_video_mode(struct usb_linect *dev, int width, int height)
 			dev->cam->view_size_depth = 2 * dev->cam->view_depth.x * dev->cam->view_depth.y;
 			dev->cam->image_size_depth = 2 * dev->cam->frame_size_depth;
 			break;
+
+		case LNT_PALETTE_DEPTHRAW:
+			dev->cam->view_size_depth = 2 * dev->cam->view_depth.x * dev->cam->view_depth.y;
+			dev->cam->image_size_depth = 2 * dev->cam->frame_size_depth;
+			break;
+
+		case LNT_PALETTE_DEPTHPACKED:
+			dev->cam->view_size_depth = DEPTH_RAW_SIZE;
+			dev->cam->image_size_depth = DEPTH_RAW_SIZE;
+			break;
+
+		case LNT_PALETTE_DEPTH10PACKED:
+			dev->cam->view_size_depth = DEPTH_10_RAW_SIZE;
+			dev->cam->image_size_depth = DEPTH_10_RAW_SIZE;
+			break;
+
+		case LNT_PALETTE_DEPTH10:
+			dev->cam->view_size_depth = 2 * dev->cam->view_depth.x * dev->cam->view_depth.y;
+			dev->cam->image_size_depth = 2 * dev->cam->frame_size_depth;
+			break;
 	}
 
 	return 0;
 }
 
 
+/** 
+ * @param palette Palette of the stream
+ * @param width Width of the stream
+ * @param fps Frame rate asked by the application
+ *
+ * @returns Nearest frame rate the camera can send the palette at
+ */
+static int v4l_linect_rgb_fps(int palette, int width, int fps)
+{
+	// The camera sends UYVY and 1280x1024 at 15 Hz only, IR at 30 Hz only
+	if (palette == LNT_PALETTE_IR8 || palette == LNT_PALETTE_IR16)
+		return 30;
+
+	if (palette == LNT_PALETTE_UYVY || width == 1280)
+		return 15;
+
+	return (fps > 22) ? 30 : 15;
+}
+
+static int v4l_linect_depth_fps(int palette, int fps)
+{
+	return (fps > 22) ? 30 : 15;
+}
+
+
+/** 
+ * @param sp Stream parameters
+ * @param fps Frame rate of the stream
+ *
+ * @brief Fill the stream parameters for VIDIOC_G_PARM and VIDIOC_S_PARM.
+ */
+static void v4l_linect_fill_parm(struct v4l2_streamparm *sp, int fps)
+{
+	memset(&sp->parm.capture, 0, sizeof(sp->parm.capture));
+
+	sp->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+	sp->parm.capture.capturemode = 0;
+	sp->parm.capture.timeperframe.numerator = 1;
+	sp->parm.capture.timeperframe.denominator = fps;
+	sp->parm.capture.readbuffers = 2;
+	sp->parm.capture.extendedmode = 0;
+}
+
+
+/** 
+ * @param sp Stream parameters
+ * @param fps Current frame rate of the stream
+ *
+ * @returns Frame rate asked by VIDIOC_S_PARM
+ */
+static int v4l_linect_parm_fps(struct v4l2_streamparm *sp, int fps)
+{
+	struct v4l2_fract *tpf = &sp->parm.capture.timeperframe;
+
+	// A null interval keeps the current rate
+	if (tpf->numerator == 0 || tpf->denominator == 0)
+		return fps;
+
+	return (tpf->denominator + tpf->numerator / 2) / tpf->numerator;
+}
+
+
 /** 
  * @param fp File pointer
  * 
@@ -248,6 +394,7 @@ static int v4l_linect_rgb_open(struct file *fp)
 	dev->cam->vframes_dumped = 0;
 	dev->cam->vsettings.depth = 24;
 	dev->cam->vsettings.palette = LNT_PALETTE_RGB24;
+	dev->cam->vsettings.fps = 30;
 
 	// Select the resolution by default
 	v4l_linect_select_video_mode(dev, 640, 480);
@@ -312,6 +459,7 @@ static int v4l_linect_depth_open(struct file *fp)
 	
 	dev->cam->depth_vsettings.depth = 24;
 	dev->cam->depth_vsettings.palette = LNT_PALETTE_RGB24;
+	dev->cam->depth_vsettings.fps = 30;
 
 	// Init Isoc and URB
 	/*err = usb_linect_depth_isoc_init(dev);
@@ -347,6 +495,8 @@ static int v4l_linect_depth_open(struct file *fp)
  */
 static int v4l_linect_rgb_release(struct file *fp)
 {
+	int i;
+
 	struct usb_linect *dev;
 	struct video_device *vdev;
 	
@@ -361,10 +511,14 @@ static int v4l_linect_rgb_release(struct file *fp)
 	// ISOC and URB cleanup
 	usb_linect_rgb_isoc_cleanup(dev);
 
-	// Free memory
-	linect_free_rgb_buffers(dev);
+	// Buffers are kept for the next open, see linect_pool_add
+	mutex_lock(&dev->cam->modlock_rgb);
+
+	for (i=0; i<LNT_MAX_IMAGES; i++)
+		linect_unpin_image(&dev->cam->images[i]);
 
 	dev->cam->vopen_rgb--;
+	mutex_unlock(&dev->cam->modlock_rgb);
 	
 	if (!dev->freeled && dev->cam->vopen_rgb == 0 && dev->cam->vopen_depth == 0) linect_motor_set_led(dev, LED_GREEN);
 
@@ -373,6 +527,8 @@ static int v4l_linect_rgb_release(struct file *fp)
 
 static int v4l_linect_depth_release(struct file *fp)
 {
+	int i;
+
 	struct usb_linect *dev;
 	struct video_device *vdev;
 	
@@ -387,13 +543,17 @@ static int v4l_linect_depth_release(struct file *fp)
 	// ISOC and URB cleanup
 	usb_linect_depth_isoc_cleanup(dev);
 
-	// Free memory
-	linect_free_depth_buffers(dev);
-
 	// Unregister interface on power management
 //	usb_autopm_put_interface(dev->cam->interface);
 
+	// Buffers are kept for the next open, see linect_pool_add
+	mutex_lock(&dev->cam->modlock_depth);
+
+	for (i=0; i<LNT_MAX_IMAGES; i++)
+		linect_unpin_image(&dev->cam->images_depth[i]);
+
 	dev->cam->vopen_depth--;
+	mutex_unlock(&dev->cam->modlock_depth);
 	
 	if (!dev->freeled && dev->cam->vopen_rgb == 0 && dev->cam->vopen_depth == 0) linect_motor_set_led(dev, LED_GREEN);
 
@@ -422,6 +582,7 @@ static ssize_t v4l_linect_rgb_read(struct file *fp, char __user *buf,
 	struct usb_linect *dev;
 	struct video_device *vdev;
 
+	int err;
 	int bytes_to_read;
 	void *image_buffer_addr;
 	
@@ -430,7 +591,10 @@ static ssize_t v4l_linect_rgb_read(struct file *fp, char __user *buf,
 	vdev = video_devdata(fp);
 	dev = video_get_drvdata(video_devdata(fp));
 	
-	usb_linect_rgb_isoc_init(dev);
+	err = usb_linect_rgb_isoc_init(dev);
+
+	if (err)
+		return err;
 
 	LNT_DEBUG("Read vdev=0x%p, buf=0x%p, count=%zd\n", vdev, buf, count);
 
@@ -442,10 +606,43 @@ static ssize_t v4l_linect_rgb_read(struct file *fp, char __user *buf,
 
 	mutex_lock(&dev->cam->modlock_rgb);
 
+	// A whole frame is converted straight into the user buffer
+	if (dev->cam->image_read_pos == 0 && count >= dev->cam->view_size && !noblock
+			&& dev->cam->memory == V4L2_MEMORY_MMAP
+			&& linect_arm_rgb_read(dev, (unsigned long) buf, dev->cam->view_size) == 0) {
+		err = 0;
+
+		add_wait_queue(&dev->cam->wait_rgb_frame, &wait);
+
+		while (dev->cam->user_image_state != LNT_IMAGE_DONE) {
+			if (dev->cam->error_status) {
+				err = -dev->cam->error_status;
+				break;
+			}
+
+			if (signal_pending(current)) {
+				err = -ERESTARTSYS;
+				break;
+			}
+
+			schedule();
+			set_current_state(TASK_INTERRUPTIBLE);
+		}
+
+		remove_wait_queue(&dev->cam->wait_rgb_frame, &wait);
+		set_current_state(TASK_RUNNING);
+
+		linect_disarm_rgb_read(dev);
+
+		mutex_unlock(&dev->cam->modlock_rgb);
+
+		return err ? err : dev->cam->view_size;
+	}
+
 	if (dev->cam->image_read_pos == 0) {
 		add_wait_queue(&dev->cam->wait_rgb_frame, &wait);
 
-		while (dev->cam->full_frames == NULL) {
+		while (linect_get_rgb_image(dev) < 0) {
 			if (dev->cam->error_status) {
 				remove_wait_queue(&dev->cam->wait_rgb_frame, &wait);
 				set_current_state(TASK_RUNNING);
@@ -473,11 +670,6 @@ static ssize_t v4l_linect_rgb_read(struct file *fp, char __user *buf,
 
 		remove_wait_queue(&dev->cam->wait_rgb_frame, &wait);
 		set_current_state(TASK_RUNNING);
-
-		if (linect_handle_rgb_frame(dev)) {
-			mutex_unlock(&dev->cam->modlock_rgb);
-			return -EFAULT;
-		}
 	}
 
 	bytes_to_read = dev->cam->view_size;
@@ -486,7 +678,7 @@ static ssize_t v4l_linect_rgb_read(struct file *fp, char __user *buf,
 		count = bytes_to_read - dev->cam->image_read_pos;
 
 	image_buffer_addr = dev->cam->image_data;
-	image_buffer_addr += dev->cam->images[dev->cam->fill_image].offset;
+	image_buffer_addr += dev->cam->images[dev->cam->read_image].offset;
 	image_buffer_addr += dev->cam->image_read_pos;
 
 	if (copy_to_user(buf, image_buffer_addr, count)) {
@@ -514,6 +706,7 @@ static ssize_t v4l_linect_depth_read(struct file *fp, char __user *buf,
 	struct usb_linect *dev;
 	struct video_device *vdev;
 
+	int err;
 	int bytes_to_read;
 	void *image_buffer_addr;
 	
@@ -522,7 +715,10 @@ static ssize_t v4l_linect_depth_read(struct file *fp, char __user *buf,
 	vdev = video_devdata(fp);
 	dev = video_get_drvdata(video_devdata(fp));
 	
-	usb_linect_depth_isoc_init(dev);
+	err = usb_linect_depth_isoc_init(dev);
+
+	if (err)
+		return err;
 
 	LNT_DEBUG("Read vdev=0x%p, buf=0x%p, count=%zd\n", vdev, buf, count);
 
@@ -534,10 +730,43 @@ static ssize_t v4l_linect_depth_read(struct file *fp, char __user *buf,
 
 	mutex_lock(&dev->cam->modlock_depth);
 
+	// A whole frame is converted straight into the user buffer
+	if (dev->cam->image_read_pos_depth == 0 && count >= dev->cam->view_size_depth && !noblock
+			&& dev->cam->memory_depth == V4L2_MEMORY_MMAP
+			&& linect_arm_depth_read(dev, (unsigned long) buf, dev->cam->view_size_depth) == 0) {
+		err = 0;
+
+		add_wait_queue(&dev->cam->wait_depth_frame, &wait);
+
+		while (dev->cam->user_image_state_depth != LNT_IMAGE_DONE) {
+			if (dev->cam->error_status) {
+				err = -dev->cam->error_status;
+				break;
+			}
+
+			if (signal_pending(current)) {
+				err = -ERESTARTSYS;
+				break;
+			}
+
+			schedule();
+			set_current_state(TASK_INTERRUPTIBLE);
+		}
+
+		remove_wait_queue(&dev->cam->wait_depth_frame, &wait);
+		set_current_state(TASK_RUNNING);
+
+		linect_disarm_depth_read(dev);
+
+		mutex_unlock(&dev->cam->modlock_depth);
+
+		return err ? err : dev->cam->view_size_depth;
+	}
+
 	if (dev->cam->image_read_pos_depth == 0) {
 		add_wait_queue(&dev->cam->wait_depth_frame, &wait);
 
-		while (dev->cam->full_frames_depth == NULL) {
+		while (linect_get_depth_image(dev) < 0) {
 			if (dev->cam->error_status) {
 				remove_wait_queue(&dev->cam->wait_depth_frame, &wait);
 				set_current_state(TASK_RUNNING);
@@ -565,20 +794,15 @@ static ssize_t v4l_linect_depth_read(struct file *fp, char __user *buf,
 
 		remove_wait_queue(&dev->cam->wait_depth_frame, &wait);
 		set_current_state(TASK_RUNNING);
-
-		if (linect_handle_depth_frame(dev)) {
-			mutex_unlock(&dev->cam->modlock_depth);
-			return -EFAULT;
-		}
 	}
 
-	bytes_to_read = 640*480*3;
+	bytes_to_read = dev->cam->view_size_depth;
 
 	if (count + dev->cam->image_read_pos_depth > bytes_to_read)
 		count = bytes_to_read - dev->cam->image_read_pos_depth;
 
 	image_buffer_addr = dev->cam->image_data_depth;
-	image_buffer_addr += dev->cam->images_depth[dev->cam->fill_image_depth].offset;
+	image_buffer_addr += dev->cam->images_depth[dev->cam->read_image_depth].offset;
 	image_buffer_addr += dev->cam->image_read_pos_depth;
 
 	if (copy_to_user(buf, image_buffer_addr, count)) {
@@ -627,7 +851,7 @@ static unsigned int v4l_linect_rgb_poll(struct file *fp, poll_table *wait)
 	if (dev->cam->error_status)
 		ret = POLLERR;
 
-	if (dev->cam->full_frames != NULL)
+	if (!list_empty(&dev->cam->done_images))
 		return (POLLIN | POLLRDNORM);
 
 	return 0;
@@ -653,13 +877,40 @@ static unsigned int v4l_linect_depth_poll(struct file *fp, poll_table *wait)
 	if (dev->cam->error_status)
 		ret = POLLERR;
 
-	if (dev->cam->full_frames_depth != NULL)
+	if (!list_empty(&dev->cam->done_images_depth))
 		return (POLLIN | POLLRDNORM);
 
 	return 0;
 }
 
 
+/** 
+ * @param vma VMA structure
+ *
+ * @brief Track the mappings of an image buffer
+ *
+ * The buffers can not be resized by VIDIOC_REQBUFS while they are mapped.
+ */
+static void linect_vm_open(struct vm_area_struct *vma)
+{
+	struct linect_image_buf *image = vma->vm_private_data;
+
+	image->vma_use_count++;
+}
+
+static void linect_vm_close(struct vm_area_struct *vma)
+{
+	struct linect_image_buf *image = vma->vm_private_data;
+
+	image->vma_use_count--;
+}
+
+static const struct vm_operations_struct linect_vm_ops = {
+	.open = linect_vm_open,
+	.close = linect_vm_close,
+};
+
+
 /** 
  * @param fp File pointer
  * @param vma VMA structure
@@ -691,6 +942,9 @@ static int v4l_linect_rgb_mmap(struct file *fp, struct vm_area_struct *vma)
 	start = vma->vm_start;
 	size = vma->vm_end - vma->vm_start;
 
+	if (dev->cam->memory != V4L2_MEMORY_MMAP)
+		return -EINVAL;
+
 	// Find the buffer for this mapping...
 	for (i=0; i<dev->cam->nbuffers; i++) {
 		pos = dev->cam->images[i].offset;
@@ -700,7 +954,7 @@ static int v4l_linect_rgb_mmap(struct file *fp, struct vm_area_struct *vma)
 	}
 
 	// If no buffer found !
-	if (i == LNT_MAX_IMAGES) {
+	if (i == dev->cam->nbuffers) {
 		LNT_ERROR("mmap no buffer found !\n");
 		return -EINVAL;
 	}
@@ -721,8 +975,11 @@ static int v4l_linect_rgb_mmap(struct file *fp, struct vm_area_struct *vma)
 		return -EINVAL;
 
 	vma->vm_flags |= VM_IO;
+	vma->vm_ops = &linect_vm_ops;
+	vma->vm_private_data = &dev->cam->images[i];
 
-	pos = (unsigned long) dev->cam->image_data;
+	// Each buffer is mapped from its own offset
+	pos = (unsigned long) dev->cam->image_data + dev->cam->images[i].offset;
 
 	while (size > 0) {
 		page = vmalloc_to_pfn((void *) pos);
@@ -739,6 +996,8 @@ static int v4l_linect_rgb_mmap(struct file *fp, struct vm_area_struct *vma)
 			size = 0;
 	}
 
+	dev->cam->images[i].vma_use_count++;
+
 	return 0;
 }
 
@@ -763,8 +1022,11 @@ static int v4l_linect_depth_mmap(struct file *fp, struct vm_area_struct *vma)
 	start = vma->vm_start;
 	size = vma->vm_end - vma->vm_start;
 
+	if (dev->cam->memory_depth != V4L2_MEMORY_MMAP)
+		return -EINVAL;
+
 	// Find the buffer for this mapping...
-	for (i=0; i<dev->cam->nbuffers; i++) {
+	for (i=0; i<dev->cam->nbuffers_depth; i++) {
 		pos = dev->cam->images_depth[i].offset;
 
 		if ((pos >> PAGE_SHIFT) == vma->vm_pgoff)
@@ -772,7 +1034,7 @@ static int v4l_linect_depth_mmap(struct file *fp, struct vm_area_struct *vma)
 	}
 
 	// If no buffer found !
-	if (i == LNT_MAX_IMAGES) {
+	if (i == dev->cam->nbuffers_depth) {
 		LNT_ERROR("mmap no buffer found !\n");
 		return -EINVAL;
 	}
@@ -780,21 +1042,24 @@ static int v4l_linect_depth_mmap(struct file *fp, struct vm_area_struct *vma)
 	if (i == 0) {
 		unsigned long total_size;
 
-		total_size = dev->cam->nbuffers * dev->cam->len_per_image;
+		total_size = dev->cam->nbuffers_depth * dev->cam->len_per_image_depth;
 
-		if (size != dev->cam->len_per_image && size != total_size) {
+		if (size != dev->cam->len_per_image_depth && size != total_size) {
 			LNT_ERROR("Wrong size (%lu) needed to be len_per_image=%d or total_size=%lu\n",
-				size, dev->cam->len_per_image, total_size);
+				size, dev->cam->len_per_image_depth, total_size);
 				
 			return -EINVAL;
 		}
 	}
-	else if (size > dev->cam->len_per_image)
+	else if (size > dev->cam->len_per_image_depth)
 		return -EINVAL;
 
 	vma->vm_flags |= VM_IO;
+	vma->vm_ops = &linect_vm_ops;
+	vma->vm_private_data = &dev->cam->images_depth[i];
 
-	pos = (unsigned long) dev->cam->image_data_depth;
+	// Each buffer is mapped from its own offset
+	pos = (unsigned long) dev->cam->image_data_depth + dev->cam->images_depth[i].offset;
 
 	while (size > 0) {
 		page = vmalloc_to_pfn((void *) pos);
@@ -811,6 +1076,8 @@ static int v4l_linect_depth_mmap(struct file *fp, struct vm_area_struct *vma)
 			size = 0;
 	}
 
+	dev->cam->images_depth[i].vma_use_count++;
+
 	return 0;
 }
 
@@ -926,6 +1193,7 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 				LNT_DEBUG("VIDIOCSPICT\n");
 
 				dev->cam->vsettings.brightness = p->brightness;
+				linect_set_brightness(dev);
 				
 				if (p->palette && p->palette != dev->cam->vsettings.palette) {
 					switch (p->palette) {
@@ -1022,7 +1290,7 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 				vm->frames = dev->cam->nbuffers;
 
 				for (i=0; i<dev->cam->nbuffers; i++)
-					vm->offsets[i] = i * dev->cam->len_per_image;
+					vm->offsets[i] = dev->cam->images[i].offset;
 			}
 			break;
 
@@ -1247,6 +1515,7 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 				switch (c->id) {
 					case V4L2_CID_BRIGHTNESS:
 						dev->cam->vsettings.brightness = (0xff00 & c->value);
+						linect_set_brightness(dev);
 						break;
 					case V4L2_CCID_MOTOR:
 						if (c->value<-31 || c->value>31) return -EINVAL;
@@ -1272,7 +1541,7 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 
 				LNT_DEBUG("VIDIOC_ENUM_FMT %d\n", fmtd->index);
 
-				if (fmtd->index != 0)
+				if (fmtd->index > 4)
 					return -EINVAL;
 
 				index = fmtd->index;
@@ -1292,33 +1561,54 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 
 					case 1:
 						fmtd->flags = 0;
-						fmtd->pixelformat = V4L2_PIX_FMT_RGB32;
+						fmtd->pixelformat = V4L2_PIX_FMT_SGRBG8;
 
-						strcpy(fmtd->description, "rgb32");
+						strcpy(fmtd->description, "bayer grbg8");
 						break;
 
 					case 2:
 						fmtd->flags = 0;
-						fmtd->pixelformat = V4L2_PIX_FMT_BGR24;
+						fmtd->pixelformat = V4L2_PIX_FMT_UYVY;
 
-						strcpy(fmtd->description, "bgr24");
+						strcpy(fmtd->description, "uyvy");
 						break;
 
 					case 3:
 						fmtd->flags = 0;
-						fmtd->pixelformat = V4L2_PIX_FMT_BGR32;
+						fmtd->pixelformat = V4L2_PIX_FMT_GREY;
 
-						strcpy(fmtd->description, "bgr32");
+						strcpy(fmtd->description, "ir 8-bit");
 						break;
 
 					case 4:
 						fmtd->flags = 0;
-						fmtd->pixelformat = V4L2_PIX_FMT_UYVY;
+						fmtd->pixelformat = V4L2_PIX_FMT_Y16;
 
-						strcpy(fmtd->description, "uyvy");
+						strcpy(fmtd->description, "ir 16-bit");
 						break;
 
 					case 5:
+						fmtd->flags = 0;
+						fmtd->pixelformat = V4L2_PIX_FMT_RGB32;
+
+						strcpy(fmtd->description, "rgb32");
+						break;
+
+					case 6:
+						fmtd->flags = 0;
+						fmtd->pixelformat = V4L2_PIX_FMT_BGR24;
+
+						strcpy(fmtd->description, "bgr24");
+						break;
+
+					case 7:
+						fmtd->flags = 0;
+						fmtd->pixelformat = V4L2_PIX_FMT_BGR32;
+
+						strcpy(fmtd->description, "bgr32");
+						break;
+
+					case 8:
 						fmtd->flags = 0;
 						fmtd->pixelformat = V4L2_PIX_FMT_YUYV;
 
@@ -1383,6 +1673,24 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 						pix_format.sizeimage = pix_format.width * pix_format.height * 2;
 						pix_format.bytesperline = 2 * pix_format.width;
 						break;
+
+					case LNT_PALETTE_SGRBG8:
+						pix_format.pixelformat = V4L2_PIX_FMT_SGRBG8;
+						pix_format.sizeimage = pix_format.width * pix_format.height;
+						pix_format.bytesperline = pix_format.width;
+						break;
+
+					case LNT_PALETTE_IR8:
+						pix_format.pixelformat = V4L2_PIX_FMT_GREY;
+						pix_format.sizeimage = pix_format.width * pix_format.height;
+						pix_format.bytesperline = pix_format.width;
+						break;
+
+					case LNT_PALETTE_IR16:
+						pix_format.pixelformat = V4L2_PIX_FMT_Y16;
+						pix_format.sizeimage = pix_format.width * pix_format.height * 2;
+						pix_format.bytesperline = 2 * pix_format.width;
+						break;
 				}
 
 				memcpy(&(fmtd->fmt.pix), &pix_format, sizeof(pix_format));
@@ -1414,12 +1722,33 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 						dev->cam->vsettings.depth = 16;
 						break;
 
+					case V4L2_PIX_FMT_SGRBG8:
+					case V4L2_PIX_FMT_GREY:
+						dev->cam->vsettings.depth = 8;
+						break;
+
+					case V4L2_PIX_FMT_Y16:
+						dev->cam->vsettings.depth = 16;
+						break;
+
 					default:
 						return -EINVAL;
 				}
-				
-				fmtd->fmt.pix.width = 640;
-				fmtd->fmt.pix.height = 480;
+
+				if (fmtd->fmt.pix.pixelformat == V4L2_PIX_FMT_GREY ||
+						fmtd->fmt.pix.pixelformat == V4L2_PIX_FMT_Y16) {
+					fmtd->fmt.pix.width = 640;
+					fmtd->fmt.pix.height = IR_FRAME_H;
+				}
+				else if (v4l_linect_rgb_hires(fmtd->fmt.pix.pixelformat != V4L2_PIX_FMT_UYVY,
+							fmtd->fmt.pix.width, fmtd->fmt.pix.height)) {
+					fmtd->fmt.pix.width = 1280;
+					fmtd->fmt.pix.height = 1024;
+				}
+				else {
+					fmtd->fmt.pix.width = 640;
+					fmtd->fmt.pix.height = 480;
+				}
 
 			}
 			break;
@@ -1433,6 +1762,18 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 				if (fmtd->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
 					return -EINVAL;
 
+				// The queued user buffers were checked against the current frame size
+				if (linect_rgb_userptr_queued(dev))
+					return -EBUSY;
+
+				// A new frame size reallocates the images, not under the stream
+				if (dev->cam->rgb_isoc_init_ok &&
+						v4l_linect_rgb_hires(fmtd->fmt.pix.pixelformat != V4L2_PIX_FMT_UYVY &&
+							fmtd->fmt.pix.pixelformat != V4L2_PIX_FMT_GREY &&
+							fmtd->fmt.pix.pixelformat != V4L2_PIX_FMT_Y16,
+							fmtd->fmt.pix.width, fmtd->fmt.pix.height) != (dev->cam->image.x == 1280))
+					return -EBUSY;
+
 				switch (fmtd->fmt.pix.pixelformat) {
 					case V4L2_PIX_FMT_RGB24:
 						dev->cam->vsettings.depth = 24;
@@ -1464,6 +1805,21 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 						dev->cam->vsettings.palette = LNT_PALETTE_YUYV;
 						break;
 
+					case V4L2_PIX_FMT_SGRBG8:
+						dev->cam->vsettings.depth = 8;
+						dev->cam->vsettings.palette = LNT_PALETTE_SGRBG8;
+						break;
+
+					case V4L2_PIX_FMT_GREY:
+						dev->cam->vsettings.depth = 8;
+						dev->cam->vsettings.palette = LNT_PALETTE_IR8;
+						break;
+
+					case V4L2_PIX_FMT_Y16:
+						dev->cam->vsettings.depth = 16;
+						dev->cam->vsettings.palette = LNT_PALETTE_IR16;
+						break;
+
 					default:
 						return -EINVAL;
 				}
@@ -1488,6 +1844,13 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 					usb_linect_rgb_isoc_init(dev);
 				
 				}
+				else if (v4l_linect_select_video_mode(dev, fmtd->fmt.pix.width, fmtd->fmt.pix.height)) {
+					LNT_ERROR("Select video mode failed !\n");
+					return -EAGAIN;
+				}
+
+				fmtd->fmt.pix.width = dev->cam->view.x;
+				fmtd->fmt.pix.height = dev->cam->view.y;
 			}
 			break;
 
@@ -1536,21 +1899,36 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 
 		case VIDIOC_REQBUFS:
 			{
+				int i;
 				int nbuffers;
 				struct v4l2_requestbuffers *rb = arg;
 
 				if (rb->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
 					return -EINVAL;
 
-				if (rb->memory != V4L2_MEMORY_MMAP)
+				if (rb->memory != V4L2_MEMORY_MMAP && rb->memory != V4L2_MEMORY_USERPTR)
 					return -EINVAL;
 
 				nbuffers = rb->count;
 
 				if (nbuffers < 2)
 					nbuffers = 2;
-				else if (nbuffers > dev->cam->nbuffers)
-					nbuffers = dev->cam->nbuffers;
+				else if (nbuffers > LNT_MAX_IMAGES)
+					nbuffers = LNT_MAX_IMAGES;
+
+				// The buffers can not move under the stream or a mapping
+				if (dev->cam->rgb_isoc_init_ok)
+					return -EBUSY;
+
+				for (i=0; i<dev->cam->nbuffers; i++) {
+					if (dev->cam->images[i].vma_use_count)
+						return -EBUSY;
+				}
+
+				if (linect_set_rgb_nbuffers(dev, nbuffers))
+					return -ENOMEM;
+
+				dev->cam->memory = rb->memory;
 
 				rb->count = dev->cam->nbuffers;
 			}
@@ -1566,7 +1944,7 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 				if (buf->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
 					return -EINVAL;
 
-				if (buf->memory != V4L2_MEMORY_MMAP) 
+				if (buf->memory != dev->cam->memory)
 					return -EINVAL;
 
 				index = buf->index;
@@ -1578,11 +1956,24 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 
 				buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 				buf->index = index;
-				buf->m.offset = index * dev->cam->len_per_image;
 				buf->bytesused = dev->cam->view_size;
 				buf->field = V4L2_FIELD_NONE;
-				buf->memory = V4L2_MEMORY_MMAP;
-				buf->length = dev->cam->len_per_image;
+				buf->memory = dev->cam->memory;
+
+				if (buf->memory == V4L2_MEMORY_USERPTR) {
+					buf->m.userptr = dev->cam->images[index].userptr;
+					buf->length = dev->cam->images[index].length;
+				}
+				else {
+					buf->m.offset = dev->cam->images[index].offset;
+					buf->length = dev->cam->len_per_image;
+					buf->flags = V4L2_BUF_FLAG_MAPPED;
+				}
+
+				if (dev->cam->image_state[index] == LNT_IMAGE_QUEUED)
+					buf->flags |= V4L2_BUF_FLAG_QUEUED;
+				else if (dev->cam->image_state[index] == LNT_IMAGE_DONE)
+					buf->flags |= V4L2_BUF_FLAG_DONE;
 			}
 			break;
 
@@ -1595,12 +1986,31 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 				if (buf->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
 					return -EINVAL;
 
-				if (buf->memory != V4L2_MEMORY_MMAP)
+				if (buf->memory != dev->cam->memory)
 					return -EINVAL;
 
 				if (buf->index < 0 || buf->index >= dev->cam->nbuffers)
 					return -EINVAL;
 
+				if (buf->memory == V4L2_MEMORY_USERPTR) {
+					int err;
+
+					if (dev->cam->image_state[buf->index] != LNT_IMAGE_DEQUEUED)
+						return -EINVAL;
+
+					if (buf->length < dev->cam->view_size)
+						return -EINVAL;
+
+					err = linect_pin_image(&dev->cam->images[buf->index], buf->m.userptr, buf->length);
+
+					if (err)
+						return err;
+				}
+
+				// Give the buffer to the conversion work
+				if (linect_queue_rgb_image(dev, buf->index))
+					return -EINVAL;
+
 				buf->flags |= V4L2_BUF_FLAG_QUEUED;
 				buf->flags &= ~V4L2_BUF_FLAG_DONE;
 			}
@@ -1608,7 +2018,6 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 
 		case VIDIOC_DQBUF:
 			{
-				int ret;
 				struct v4l2_buffer *buf = arg;
 
 				//LNT_DEBUG("VIDIOC_DQBUF\n");
@@ -1618,7 +2027,7 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 
 				add_wait_queue(&dev->cam->wait_rgb_frame, &wait);
 
-				while (dev->cam->full_frames == NULL) {
+				while (linect_get_rgb_image(dev) < 0) {
 					if (dev->cam->error_status) {
 						remove_wait_queue(&dev->cam->wait_rgb_frame, &wait);
 						set_current_state(TASK_RUNNING);
@@ -1626,6 +2035,21 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 						return -dev->cam->error_status;
 					}
 
+					// Nothing will ever be done
+					if (!dev->cam->rgb_isoc_init_ok) {
+						remove_wait_queue(&dev->cam->wait_rgb_frame, &wait);
+						set_current_state(TASK_RUNNING);
+
+						return -EINVAL;
+					}
+
+					if (fp->f_flags & O_NONBLOCK) {
+						remove_wait_queue(&dev->cam->wait_rgb_frame, &wait);
+						set_current_state(TASK_RUNNING);
+
+						return -EAGAIN;
+					}
+
 					if (signal_pending(current)) {
 						remove_wait_queue(&dev->cam->wait_rgb_frame, &wait);
 						set_current_state(TASK_RUNNING);
@@ -1642,22 +2066,23 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 
 				//LNT_DEBUG("VIDIOC_DQBUF : frame ready.\n");
 
-				ret = linect_handle_rgb_frame(dev);
-
-				if (ret)
-					return -EFAULT;
-
-				buf->index = dev->cam->fill_image;
+				buf->index = dev->cam->read_image;
 				buf->bytesused = dev->cam->view_size;
-				buf->flags = V4L2_BUF_FLAG_MAPPED;
+				buf->flags = 0;
 				buf->field = V4L2_FIELD_NONE;
 				do_gettimeofday(&buf->timestamp);
-				buf->sequence = 0;
-				buf->memory = V4L2_MEMORY_MMAP;
-				buf->m.offset = dev->cam->fill_image * dev->cam->len_per_image;
-				buf->length = dev->cam->len_per_image; //buf->bytesused;
+				buf->sequence = dev->cam->image_seq[buf->index];
+				buf->memory = dev->cam->memory;
 
-				linect_next_rgb_image(dev);
+				if (buf->memory == V4L2_MEMORY_USERPTR) {
+					buf->m.userptr = dev->cam->images[buf->index].userptr;
+					buf->length = dev->cam->images[buf->index].length;
+				}
+				else {
+					buf->flags |= V4L2_BUF_FLAG_MAPPED;
+					buf->m.offset = dev->cam->images[buf->index].offset;
+					buf->length = dev->cam->len_per_image; //buf->bytesused;
+				}
 			}
 			break;
 
@@ -1665,7 +2090,7 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 			{
 				LNT_DEBUG("VIDIOC_STREAMON\n");
 
-				usb_linect_rgb_isoc_init(dev);
+				return usb_linect_rgb_isoc_init(dev);
 			}
 			break;
 
@@ -1674,6 +2099,9 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 				LNT_DEBUG("VIDIOC_STREAMOFF\n");
 
 				usb_linect_rgb_isoc_cleanup(dev);
+
+				// All the buffers go back to the application
+				linect_flush_rgb_images(dev);
 			}
 			break;
 
@@ -1686,12 +2114,135 @@ static long v4l_linect_rgb_do_ioctl(struct file *fp,
 				if (sp->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
 					return -EINVAL;
 
-				sp->parm.capture.capability = 0;
-				sp->parm.capture.capturemode = 0;
-				sp->parm.capture.timeperframe.numerator = 1;
-				sp->parm.capture.timeperframe.denominator = 30;
-				sp->parm.capture.readbuffers = 2;
-				sp->parm.capture.extendedmode = 0;
+				v4l_linect_fill_parm(sp, v4l_linect_rgb_fps(dev->cam->vsettings.palette,
+							dev->cam->view.x, dev->cam->vsettings.fps));
+			}
+			break;
+
+		case VIDIOC_S_PARM:
+			{
+				int fps, err;
+				struct v4l2_streamparm *sp = arg;
+
+				LNT_DEBUG("SET PARM %d\n", sp->type);
+
+				if (sp->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+					return -EINVAL;
+
+				fps = v4l_linect_parm_fps(sp, dev->cam->vsettings.fps);
+				fps = v4l_linect_rgb_fps(dev->cam->vsettings.palette, dev->cam->view.x, fps);
+
+				LNT_DEBUG("Set %d fps\n", fps);
+
+				if (fps != dev->cam->vsettings.fps) {
+					dev->cam->vsettings.fps = fps;
+
+					// The rate is programmed when the stream starts
+					if (dev->cam->rgb_isoc_init_ok) {
+						usb_linect_rgb_isoc_cleanup(dev);
+						err = usb_linect_rgb_isoc_init(dev);
+
+						if (err)
+							return err;
+					}
+				}
+
+				v4l_linect_fill_parm(sp, fps);
+			}
+			break;
+
+		case VIDIOC_ENUM_FRAMESIZES:
+			{
+				struct v4l2_frmsizeenum *fsize = arg;
+
+				LNT_DEBUG("ENUM FRAMESIZES %d\n", fsize->index);
+
+				switch (fsize->pixel_format) {
+					case V4L2_PIX_FMT_GREY:
+					case V4L2_PIX_FMT_Y16:
+						if (fsize->index > 0)
+							return -EINVAL;
+
+						fsize->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+						fsize->discrete.width = 640;
+						fsize->discrete.height = IR_FRAME_H;
+						return 0;
+
+					case V4L2_PIX_FMT_UYVY:
+						if (fsize->index > 0)
+							return -EINVAL;
+						break;
+
+					case V4L2_PIX_FMT_RGB24:
+					case V4L2_PIX_FMT_SGRBG8:
+					case V4L2_PIX_FMT_RGB32:
+					case V4L2_PIX_FMT_BGR24:
+					case V4L2_PIX_FMT_BGR32:
+					case V4L2_PIX_FMT_YUYV:
+						if (fsize->index > 1)
+							return -EINVAL;
+						break;
+
+					default:
+						return -EINVAL;
+				}
+
+				fsize->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+				fsize->discrete.width = fsize->index ? 1280 : 640;
+				fsize->discrete.height = fsize->index ? 1024 : 480;
+			}
+			break;
+
+		case VIDIOC_ENUM_FRAMEINTERVALS:
+			{
+				int palette;
+				struct v4l2_frmivalenum *fival = arg;
+
+				LNT_DEBUG("ENUM FRAMEINTERVALS %d\n", fival->index);
+
+				switch (fival->pixel_format) {
+					case V4L2_PIX_FMT_GREY:
+					case V4L2_PIX_FMT_Y16:
+						if (fival->width != 640 || fival->height != IR_FRAME_H)
+							return -EINVAL;
+
+						palette = LNT_PALETTE_IR8;
+						break;
+
+					case V4L2_PIX_FMT_UYVY:
+						if (fival->width != 640 || fival->height != 480)
+							return -EINVAL;
+
+						palette = LNT_PALETTE_UYVY;
+						break;
+
+					case V4L2_PIX_FMT_RGB24:
+					case V4L2_PIX_FMT_SGRBG8:
+					case V4L2_PIX_FMT_RGB32:
+					case V4L2_PIX_FMT_BGR24:
+					case V4L2_PIX_FMT_BGR32:
+					case V4L2_PIX_FMT_YUYV:
+						if (!(fival->width == 640 && fival->height == 480) &&
+								!(fival->width == 1280 && fival->height == 1024))
+							return -EINVAL;
+
+						palette = LNT_PALETTE_RGB24;
+						break;
+
+					default:
+						return -EINVAL;
+				}
+
+				// Fastest rate first. UYVY, IR and 1280x1024 have only one.
+				if (fival->index > 1 || (fival->index == 1 &&
+							v4l_linect_rgb_fps(palette, fival->width, 30) ==
+							v4l_linect_rgb_fps(palette, fival->width, 15)))
+					return -EINVAL;
+
+				fival->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+				fival->discrete.numerator = 1;
+				fival->discrete.denominator = v4l_linect_rgb_fps(palette, fival->width,
+						fival->index ? 15 : 30);
 			}
 			break;
 
@@ -1863,11 +2414,11 @@ static long v4l_linect_depth_do_ioctl(struct file *fp,
 
 				memset(vm, 0, sizeof(*vm));
 
-				vm->size = dev->cam->nbuffers * dev->cam->len_per_image;
-				vm->frames = dev->cam->nbuffers;
+				vm->size = dev->cam->nbuffers_depth * dev->cam->len_per_image_depth;
+				vm->frames = dev->cam->nbuffers_depth;
 
-				for (i=0; i<dev->cam->nbuffers; i++)
-					vm->offsets[i] = i * dev->cam->len_per_image;
+				for (i=0; i<dev->cam->nbuffers_depth; i++)
+					vm->offsets[i] = dev->cam->images_depth[i].offset;
 			}
 			break;
 
@@ -2100,7 +2651,7 @@ static long v4l_linect_depth_do_ioctl(struct file *fp,
 
 				LNT_DEBUG("VIDIOC_ENUM_FMT %d\n", fmtd->index);
 
-				if (fmtd->index != 0)
+				if (fmtd->index > 3)
 					return -EINVAL;
 
 				index = fmtd->index;
@@ -2118,8 +2669,35 @@ static long v4l_linect_depth_do_ioctl(struct file *fp,
 
 						strcpy(fmtd->description, "rgb24");
 						break;
-						
+
 					case 1:
+						fmtd->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+						fmtd->index = index;
+						fmtd->flags = 0;
+						fmtd->pixelformat = V4L2_PIX_FMT_LNT_Y11P;
+
+						strcpy(fmtd->description, "packed 11-bit depth");
+						break;
+
+					case 2:
+						fmtd->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+						fmtd->index = index;
+						fmtd->flags = 0;
+						fmtd->pixelformat = V4L2_PIX_FMT_Y10BPACK;
+
+						strcpy(fmtd->description, "packed 10-bit depth");
+						break;
+
+					case 3:
+						fmtd->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+						fmtd->index = index;
+						fmtd->flags = 0;
+						fmtd->pixelformat = V4L2_PIX_FMT_Y10;
+
+						strcpy(fmtd->description, "10-bit depth");
+						break;
+						
+					case 4:
 						fmtd->type = V4L2_BUF_TYPE_PRIVATE;
 						fmtd->index = index;
 						fmtd->flags = 0;
@@ -2165,6 +2743,30 @@ static long v4l_linect_depth_do_ioctl(struct file *fp,
 						pix_format.priv = 0;
 						fmtd->type = V4L2_BUF_TYPE_PRIVATE;
 						break;
+
+					case LNT_PALETTE_DEPTHPACKED:
+						pix_format.pixelformat = V4L2_PIX_FMT_LNT_Y11P;
+						pix_format.sizeimage = DEPTH_RAW_SIZE;
+						pix_format.bytesperline = (11 * pix_format.width) / 8;
+						pix_format.priv = 0;
+						fmtd->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+						break;
+
+					case LNT_PALETTE_DEPTH10PACKED:
+						pix_format.pixelformat = V4L2_PIX_FMT_Y10BPACK;
+						pix_format.sizeimage = DEPTH_10_RAW_SIZE;
+						pix_format.bytesperline = (10 * pix_format.width) / 8;
+						pix_format.priv = 0;
+						fmtd->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+						break;
+
+					case LNT_PALETTE_DEPTH10:
+						pix_format.pixelformat = V4L2_PIX_FMT_Y10;
+						pix_format.sizeimage = pix_format.width * pix_format.height * 2;
+						pix_format.bytesperline = 2 * pix_format.width;
+						pix_format.priv = 0;
+						fmtd->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+						break;
 				}
 						
 
@@ -2185,6 +2787,18 @@ static long v4l_linect_depth_do_ioctl(struct file *fp,
 					case V4L2_BUF_TYPE_VIDEO_CAPTURE:
 						if (fmtd->fmt.pix.pixelformat == V4L2_PIX_FMT_RGB24) {
 							dev->cam->vsettings.depth = 24;
+						}
+						else if (fmtd->fmt.pix.pixelformat == V4L2_PIX_FMT_LNT_Y11P) {
+							fmtd->fmt.pix.bytesperline = (11 * 640) / 8;
+							fmtd->fmt.pix.sizeimage = DEPTH_RAW_SIZE;
+						}
+						else if (fmtd->fmt.pix.pixelformat == V4L2_PIX_FMT_Y10BPACK) {
+							fmtd->fmt.pix.bytesperline = (10 * 640) / 8;
+							fmtd->fmt.pix.sizeimage = DEPTH_10_RAW_SIZE;
+						}
+						else if (fmtd->fmt.pix.pixelformat == V4L2_PIX_FMT_Y10) {
+							fmtd->fmt.pix.bytesperline = 2 * 640;
+							fmtd->fmt.pix.sizeimage = 2 * 640 * 480;
 						} else return -EINVAL;
 					break;
 					case V4L2_BUF_TYPE_PRIVATE:
@@ -2209,11 +2823,27 @@ static long v4l_linect_depth_do_ioctl(struct file *fp,
 				if (fmtd->type != V4L2_BUF_TYPE_VIDEO_CAPTURE && fmtd->type != V4L2_BUF_TYPE_PRIVATE)
 					return -EINVAL;
 
+				// The queued user buffers were checked against the current frame size
+				if (linect_depth_userptr_queued(dev))
+					return -EBUSY;
+
 				switch (fmtd->type) {
 					case V4L2_BUF_TYPE_VIDEO_CAPTURE:
 						if (fmtd->fmt.pix.pixelformat == V4L2_PIX_FMT_RGB24) {
 							dev->cam->depth_vsettings.depth = 24;
 							dev->cam->depth_vsettings.palette = LNT_PALETTE_RGB24;
+						}
+						else if (fmtd->fmt.pix.pixelformat == V4L2_PIX_FMT_LNT_Y11P) {
+							dev->cam->depth_vsettings.depth = 11;
+							dev->cam->depth_vsettings.palette = LNT_PALETTE_DEPTHPACKED;
+						}
+						else if (fmtd->fmt.pix.pixelformat == V4L2_PIX_FMT_Y10BPACK) {
+							dev->cam->depth_vsettings.depth = 10;
+							dev->cam->depth_vsettings.palette = LNT_PALETTE_DEPTH10PACKED;
+						}
+						else if (fmtd->fmt.pix.pixelformat == V4L2_PIX_FMT_Y10) {
+							dev->cam->depth_vsettings.depth = 16;
+							dev->cam->depth_vsettings.palette = LNT_PALETTE_DEPTH10;
 						} else return -EINVAL;
 					break;
 					case V4L2_BUF_TYPE_PRIVATE:
@@ -2230,6 +2860,12 @@ static long v4l_linect_depth_do_ioctl(struct file *fp,
 					// ISOC and URB cleanup
 					usb_linect_depth_isoc_cleanup(dev);
 
+					// Update the depth image size, the RGB mode is kept
+					if (v4l_linect_select_video_mode(dev, dev->cam->view.x, dev->cam->view.y)) {
+						LNT_ERROR("Select video mode failed !\n");
+						return -EAGAIN;
+					}
+
 					// Clear the buffers
 					linect_clear_depth_buffers(dev);
 
@@ -2237,6 +2873,16 @@ static long v4l_linect_depth_do_ioctl(struct file *fp,
 					usb_linect_depth_isoc_init(dev);
 				
 				}
+				else if (v4l_linect_select_video_mode(dev, dev->cam->view.x, dev->cam->view.y)) {
+					LNT_ERROR("Select video mode failed !\n");
+					return -EAGAIN;
+				}
+
+				// Report the size that read() returns, as TRY_FMT does
+				fmtd->fmt.pix.width = dev->cam->view_depth.x;
+				fmtd->fmt.pix.height = dev->cam->view_depth.y;
+				fmtd->fmt.pix.bytesperline = dev->cam->view_size_depth / dev->cam->view_depth.y;
+				fmtd->fmt.pix.sizeimage = dev->cam->view_size_depth;
 			}
 			break;
 
@@ -2285,23 +2931,38 @@ static long v4l_linect_depth_do_ioctl(struct file *fp,
 
 		case VIDIOC_REQBUFS:
 			{
+				int i;
 				int nbuffers;
 				struct v4l2_requestbuffers *rb = arg;
 
 				if (rb->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
 					return -EINVAL;
 
-				if (rb->memory != V4L2_MEMORY_MMAP)
+				if (rb->memory != V4L2_MEMORY_MMAP && rb->memory != V4L2_MEMORY_USERPTR)
 					return -EINVAL;
 
 				nbuffers = rb->count;
 
 				if (nbuffers < 2)
 					nbuffers = 2;
-				else if (nbuffers > dev->cam->nbuffers)
-					nbuffers = dev->cam->nbuffers;
+				else if (nbuffers > LNT_MAX_IMAGES)
+					nbuffers = LNT_MAX_IMAGES;
 
-				rb->count = dev->cam->nbuffers;
+				// The buffers can not move under the stream or a mapping
+				if (dev->cam->depth_isoc_init_ok)
+					return -EBUSY;
+
+				for (i=0; i<dev->cam->nbuffers_depth; i++) {
+					if (dev->cam->images_depth[i].vma_use_count)
+						return -EBUSY;
+				}
+
+				if (linect_set_depth_nbuffers(dev, nbuffers))
+					return -ENOMEM;
+
+				dev->cam->memory_depth = rb->memory;
+
+				rb->count = dev->cam->nbuffers_depth;
 			}
 			break;
 
@@ -2310,28 +2971,41 @@ static long v4l_linect_depth_do_ioctl(struct file *fp,
 				int index;
 				struct v4l2_buffer *buf = arg;
 
-				LNT_DEBUG("QUERY BUFFERS %d %d\n", buf->index, dev->cam->nbuffers);
+				LNT_DEBUG("QUERY BUFFERS %d %d\n", buf->index, dev->cam->nbuffers_depth);
 
 				if (buf->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
 					return -EINVAL;
 
-				if (buf->memory != V4L2_MEMORY_MMAP) 
+				if (buf->memory != dev->cam->memory_depth)
 					return -EINVAL;
 
 				index = buf->index;
 
-				if (index < 0 || index >= dev->cam->nbuffers)
+				if (index < 0 || index >= dev->cam->nbuffers_depth)
 					return -EINVAL;
 
 				memset(buf, 0, sizeof(struct v4l2_buffer));
 
 				buf->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 				buf->index = index;
-				buf->m.offset = index * dev->cam->len_per_image;
-				buf->bytesused = dev->cam->view_size;
+				buf->bytesused = dev->cam->view_size_depth;
 				buf->field = V4L2_FIELD_NONE;
-				buf->memory = V4L2_MEMORY_MMAP;
-				buf->length = dev->cam->len_per_image;
+				buf->memory = dev->cam->memory_depth;
+
+				if (buf->memory == V4L2_MEMORY_USERPTR) {
+					buf->m.userptr = dev->cam->images_depth[index].userptr;
+					buf->length = dev->cam->images_depth[index].length;
+				}
+				else {
+					buf->m.offset = dev->cam->images_depth[index].offset;
+					buf->length = dev->cam->len_per_image_depth;
+					buf->flags = V4L2_BUF_FLAG_MAPPED;
+				}
+
+				if (dev->cam->image_state_depth[index] == LNT_IMAGE_QUEUED)
+					buf->flags |= V4L2_BUF_FLAG_QUEUED;
+				else if (dev->cam->image_state_depth[index] == LNT_IMAGE_DONE)
+					buf->flags |= V4L2_BUF_FLAG_DONE;
 			}
 			break;
 
@@ -2344,10 +3018,29 @@ static long v4l_linect_depth_do_ioctl(struct file *fp,
 				if (buf->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
 					return -EINVAL;
 
-				if (buf->memory != V4L2_MEMORY_MMAP)
+				if (buf->memory != dev->cam->memory_depth)
 					return -EINVAL;
 
-				if (buf->index < 0 || buf->index >= dev->cam->nbuffers)
+				if (buf->index < 0 || buf->index >= dev->cam->nbuffers_depth)
+					return -EINVAL;
+
+				if (buf->memory == V4L2_MEMORY_USERPTR) {
+					int err;
+
+					if (dev->cam->image_state_depth[buf->index] != LNT_IMAGE_DEQUEUED)
+						return -EINVAL;
+
+					if (buf->length < dev->cam->view_size_depth)
+						return -EINVAL;
+
+					err = linect_pin_image(&dev->cam->images_depth[buf->index], buf->m.userptr, buf->length);
+
+					if (err)
+						return err;
+				}
+
+				// Give the buffer to the conversion work
+				if (linect_queue_depth_image(dev, buf->index))
 					return -EINVAL;
 
 				buf->flags |= V4L2_BUF_FLAG_QUEUED;
@@ -2357,7 +3050,6 @@ static long v4l_linect_depth_do_ioctl(struct file *fp,
 
 		case VIDIOC_DQBUF:
 			{
-				int ret;
 				struct v4l2_buffer *buf = arg;
 
 				LNT_DEBUG("VIDIOC_DQBUF\n");
@@ -2367,7 +3059,7 @@ static long v4l_linect_depth_do_ioctl(struct file *fp,
 
 				add_wait_queue(&dev->cam->wait_depth_frame, &wait);
 
-				while (dev->cam->full_frames_depth == NULL) {
+				while (linect_get_depth_image(dev) < 0) {
 					if (dev->cam->error_status) {
 						remove_wait_queue(&dev->cam->wait_depth_frame, &wait);
 						set_current_state(TASK_RUNNING);
@@ -2375,6 +3067,21 @@ static long v4l_linect_depth_do_ioctl(struct file *fp,
 						return -dev->cam->error_status;
 					}
 
+					// Nothing will ever be done
+					if (!dev->cam->depth_isoc_init_ok) {
+						remove_wait_queue(&dev->cam->wait_depth_frame, &wait);
+						set_current_state(TASK_RUNNING);
+
+						return -EINVAL;
+					}
+
+					if (fp->f_flags & O_NONBLOCK) {
+						remove_wait_queue(&dev->cam->wait_depth_frame, &wait);
+						set_current_state(TASK_RUNNING);
+
+						return -EAGAIN;
+					}
+
 					if (signal_pending(current)) {
 						remove_wait_queue(&dev->cam->wait_depth_frame, &wait);
 						set_current_state(TASK_RUNNING);
@@ -2391,22 +3098,23 @@ static long v4l_linect_depth_do_ioctl(struct file *fp,
 
 				LNT_DEBUG("VIDIOC_DQBUF : frame ready.\n");
 
-				ret = linect_handle_depth_frame(dev);
-
-				if (ret)
-					return -EFAULT;
-
-				buf->index = dev->cam->fill_image_depth;
-				buf->bytesused = dev->cam->view_size;
-				buf->flags = V4L2_BUF_FLAG_MAPPED;
+				buf->index = dev->cam->read_image_depth;
+				buf->bytesused = dev->cam->view_size_depth;
+				buf->flags = 0;
 				buf->field = V4L2_FIELD_NONE;
 				do_gettimeofday(&buf->timestamp);
-				buf->sequence = 0;
-				buf->memory = V4L2_MEMORY_MMAP;
-				buf->m.offset = dev->cam->fill_image_depth * dev->cam->len_per_image;
-				buf->length = dev->cam->len_per_image; //buf->bytesused;
+				buf->sequence = dev->cam->image_seq_depth[buf->index];
+				buf->memory = dev->cam->memory_depth;
 
-				linect_next_depth_image(dev);
+				if (buf->memory == V4L2_MEMORY_USERPTR) {
+					buf->m.userptr = dev->cam->images_depth[buf->index].userptr;
+					buf->length = dev->cam->images_depth[buf->index].length;
+				}
+				else {
+					buf->flags |= V4L2_BUF_FLAG_MAPPED;
+					buf->m.offset = dev->cam->images_depth[buf->index].offset;
+					buf->length = dev->cam->len_per_image_depth; //buf->bytesused;
+				}
 			}
 			break;
 
@@ -2414,7 +3122,7 @@ static long v4l_linect_depth_do_ioctl(struct file *fp,
 			{
 				LNT_DEBUG("VIDIOC_STREAMON\n");
 
-				usb_linect_depth_isoc_init(dev);
+				return usb_linect_depth_isoc_init(dev);
 			}
 			break;
 
@@ -2423,6 +3131,9 @@ static long v4l_linect_depth_do_ioctl(struct file *fp,
 				LNT_DEBUG("VIDIOC_STREAMOFF\n");
 
 				usb_linect_depth_isoc_cleanup(dev);
+
+				// All the buffers go back to the application
+				linect_flush_depth_images(dev);
 			}
 			break;
 
@@ -2435,12 +3146,97 @@ static long v4l_linect_depth_do_ioctl(struct file *fp,
 				if (sp->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
 					return -EINVAL;
 
-				sp->parm.capture.capability = 0;
-				sp->parm.capture.capturemode = 0;
-				sp->parm.capture.timeperframe.numerator = 1;
-				sp->parm.capture.timeperframe.denominator = 30;
-				sp->parm.capture.readbuffers = 2;
-				sp->parm.capture.extendedmode = 0;
+				v4l_linect_fill_parm(sp, v4l_linect_depth_fps(dev->cam->depth_vsettings.palette,
+							dev->cam->depth_vsettings.fps));
+			}
+			break;
+
+		case VIDIOC_S_PARM:
+			{
+				int fps, err;
+				struct v4l2_streamparm *sp = arg;
+
+				LNT_DEBUG("SET PARM %d\n", sp->type);
+
+				if (sp->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+					return -EINVAL;
+
+				fps = v4l_linect_parm_fps(sp, dev->cam->depth_vsettings.fps);
+				fps = v4l_linect_depth_fps(dev->cam->depth_vsettings.palette, fps);
+
+				LNT_DEBUG("Set %d fps\n", fps);
+
+				if (fps != dev->cam->depth_vsettings.fps) {
+					dev->cam->depth_vsettings.fps = fps;
+
+					// The rate is programmed when the stream starts
+					if (dev->cam->depth_isoc_init_ok) {
+						usb_linect_depth_isoc_cleanup(dev);
+						err = usb_linect_depth_isoc_init(dev);
+
+						if (err)
+							return err;
+					}
+				}
+
+				v4l_linect_fill_parm(sp, fps);
+			}
+			break;
+
+		case VIDIOC_ENUM_FRAMESIZES:
+			{
+				struct v4l2_frmsizeenum *fsize = arg;
+
+				LNT_DEBUG("ENUM FRAMESIZES %d\n", fsize->index);
+
+				if (fsize->index != 0)
+					return -EINVAL;
+
+				switch (fsize->pixel_format) {
+					case V4L2_PIX_FMT_RGB24:
+					case V4L2_PIX_FMT_LNT_Y11P:
+					case V4L2_PIX_FMT_Y10BPACK:
+					case V4L2_PIX_FMT_Y10:
+					case V4L2_PIX_FMT_DV:
+						break;
+
+					default:
+						return -EINVAL;
+				}
+
+				fsize->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+				fsize->discrete.width = 640;
+				fsize->discrete.height = 480;
+			}
+			break;
+
+		case VIDIOC_ENUM_FRAMEINTERVALS:
+			{
+				struct v4l2_frmivalenum *fival = arg;
+
+				LNT_DEBUG("ENUM FRAMEINTERVALS %d\n", fival->index);
+
+				if (fival->width != 640 || fival->height != 480)
+					return -EINVAL;
+
+				switch (fival->pixel_format) {
+					case V4L2_PIX_FMT_RGB24:
+					case V4L2_PIX_FMT_LNT_Y11P:
+					case V4L2_PIX_FMT_Y10BPACK:
+					case V4L2_PIX_FMT_Y10:
+					case V4L2_PIX_FMT_DV:
+						break;
+
+					default:
+						return -EINVAL;
+				}
+
+				if (fival->index > 1)
+					return -EINVAL;
+
+				fival->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+				fival->discrete.numerator = 1;
+				fival->discrete.denominator = fival->index ? 15 : 30;
 			}
 			break;
 
@@ -2579,6 +3375,7 @@ static long v4l_linect_depth_ioctl(struct file *fp,
  * @brief Register the video device
  *
  * This function permits to register the USB device to the video device.
+ * On error the video device is left unregistered.
  */
 int v4l_linect_register_rgb_video_device(struct usb_linect *dev)
 {
@@ -2597,9 +3394,21 @@ int v4l_linect_register_rgb_video_device(struct usb_linect *dev)
 
 	if (err)
 		LNT_ERROR("Video register fail !\n");
-	else
+	else {
 		LNT_INFO("Linect is now controlling video device /dev/video%d\n", dev->cam->vdev->minor);
 
+		err = linect_create_sysfs_files(dev->cam->vdev);
+
+		if (err) {
+			LNT_ERROR("Sysfs entries creation fail !\n");
+
+			// The release callback frees the video device
+			linect_remove_sysfs_files(dev->cam->vdev);
+			video_unregister_device(dev->cam->vdev);
+			dev->cam->vdev = NULL;
+		}
+	}
+
 	return err;
 }
 
@@ -2620,9 +3429,21 @@ int v4l_linect_register_depth_video_device(struct usb_linect *dev)
 
 	if (err)
 		LNT_ERROR("Video register fail !\n");
-	else
+	else {
 		LNT_INFO("Linect is now controlling depth video device /dev/video%d\n", dev->cam->depth_vdev->minor);
 
+		err = linect_create_sysfs_files(dev->cam->depth_vdev);
+
+		if (err) {
+			LNT_ERROR("Sysfs entries creation fail !\n");
+
+			// The release callback frees the video device
+			linect_remove_sysfs_files(dev->cam->depth_vdev);
+			video_unregister_device(dev->cam->depth_vdev);
+			dev->cam->depth_vdev = NULL;
+		}
+	}
+
 	return err;
 }
 
@@ -2640,6 +3461,8 @@ int v4l_linect_unregister_rgb_video_device(struct usb_linect *dev)
 {
 	LNT_INFO("Kinect release resources video device /dev/video%d\n", dev->cam->vdev->minor);
 
+	linect_remove_sysfs_files(dev->cam->vdev);
+
 	video_set_drvdata(dev->cam->vdev, NULL);
 	video_unregister_device(dev->cam->vdev);
 
@@ -2650,6 +3473,8 @@ int v4l_linect_unregister_depth_video_device(struct usb_linect *dev)
 {
 	LNT_INFO("Kinect release depth resources video device /dev/video%d\n", dev->cam->vdev->minor);
 
+	linect_remove_sysfs_files(dev->cam->depth_vdev);
+
 	video_set_drvdata(dev->cam->depth_vdev, NULL);
 	video_unregister_device(dev->cam->depth_vdev);
 
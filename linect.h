@@ -57,6 +57,9 @@
 #define FREENECT_DEPTH_SIZE (FREENECT_FRAME_PIX*sizeof(freenect_depth))
 
 #define DEPTH_RAW_SIZE 422400
+#define DEPTH_10_RAW_SIZE 384000
+#define IR_FRAME_H 488
+#define IR_RAW_SIZE (FRAME_W*IR_FRAME_H*10/8)
 #define FRAME_H FREENECT_FRAME_H
 #define FRAME_W FREENECT_FRAME_W
 #define FRAME_PIX FREENECT_FRAME_PIX
@@ -68,10 +71,16 @@
 #define RGB_PKTDSIZE (RGB_PKTSIZE-12)
 
 #define DEPTH_PKTS_PER_FRAME ((DEPTH_RAW_SIZE+DEPTH_PKTDSIZE-1)/DEPTH_PKTDSIZE)
+#define DEPTH_10_PKTS_PER_FRAME ((DEPTH_10_RAW_SIZE+DEPTH_PKTDSIZE-1)/DEPTH_PKTDSIZE)
 #define RGB_PKTS_PER_FRAME ((FRAME_PIX+RGB_PKTDSIZE-1)/RGB_PKTDSIZE)
+#define RGB_YUV_PKTS_PER_FRAME ((2*FRAME_PIX+RGB_PKTDSIZE-1)/RGB_PKTDSIZE)
+#define RGB_HR_PKTS_PER_FRAME ((1280*1024+RGB_PKTDSIZE-1)/RGB_PKTDSIZE)
+#define RGB_IR_PKTS_PER_FRAME ((IR_RAW_SIZE+RGB_PKTDSIZE-1)/RGB_PKTDSIZE)
 
 #define PKTS_PER_XFER 16
 #define NUM_XFERS 16
+#define MAX_PKTS_PER_XFER 64
+#define MAX_XFERS 64
 #define DEPTH_PKTBUF 1920
 #define RGB_PKTBUF 1920
 
@@ -89,7 +98,14 @@
 
 /* Image frame buffer */
 #define LNT_MAX_IMAGES			10
-#define LNT_FRAME_SIZE			(1280 * 1024 * 4)
+
+/* Vector kernels (see Kbuild, LNT_SIMD_SSSE3 is set there) */
+#if defined(CONFIG_X86_64)
+#define LNT_SIMD_X86
+#endif
+
+/* Number of rows converted per vector section, see bayer_frame */
+#define LNT_SIMD_ROWS			16
 
 /* Info print */
 
@@ -150,10 +166,46 @@ typedef enum {
 	LNT_PALETTE_BGR32 = 4,
 	LNT_PALETTE_UYVY = 5,
 	LNT_PALETTE_YUYV = 6,
-	LNT_PALETTE_DEPTHRAW = 7
+	LNT_PALETTE_DEPTHRAW = 7,
+	LNT_PALETTE_SGRBG8 = 8,
+	LNT_PALETTE_DEPTHPACKED = 9,
+	LNT_PALETTE_DEPTH10PACKED = 10,
+	LNT_PALETTE_DEPTH10 = 11,
+	LNT_PALETTE_IR8 = 12,
+	LNT_PALETTE_IR16 = 13
 } T_LNT_PALETTE;
 
 
+/**
+ * @enum T_LNT_RGB_FORMAT Format sent by the RGB camera
+ */
+typedef enum {
+	LNT_RGB_BAYER = 0,			/**< GRBG Bayer, 640x480 at 30 Hz */
+	LNT_RGB_UYVY = 1,			/**< UYVY, 640x480 at 15 Hz */
+	LNT_RGB_BAYER_HR = 2,		/**< GRBG Bayer, 1280x1024 at 15 Hz */
+	LNT_RGB_IR = 3				/**< IR 10 bits packed, 640x488 at 30 Hz */
+} T_LNT_RGB_FORMAT;
+
+
+/**
+ * @enum T_LNT_DEPTH_FORMAT Format sent by the depth camera
+ */
+typedef enum {
+	LNT_DEPTH_11BIT = 0,		/**< 11 bits packed, 422400 bytes */
+	LNT_DEPTH_10BIT = 1			/**< 10 bits packed, 384000 bytes */
+} T_LNT_DEPTH_FORMAT;
+
+
+/**
+ * @enum T_LNT_IMAGE_STATE Owner of an image buffer
+ */
+typedef enum {
+	LNT_IMAGE_QUEUED = 0,			/**< Owned by the driver, can be filled */
+	LNT_IMAGE_DONE = 1,			/**< Filled, waiting to be dequeued */
+	LNT_IMAGE_DEQUEUED = 2			/**< Owned by the application */
+} T_LNT_IMAGE_STATE;
+
+
 /**
  * @struct linect_iso_buf
  */
@@ -172,7 +224,58 @@ struct linect_frame_buf {
 	int errors;
 	void *data;
 	volatile int filled;
-	struct linect_frame_buf *next;
+	uint32_t timestamp;					/**< Device timestamp of the frame */
+};
+
+
+/**
+ * @struct linect_frame_ring
+ *
+ * Frame buffers shared by the isochronous tasklet, which fills them, and the
+ * conversion work, which reads them. Each index is only written by one side.
+ */
+struct linect_frame_ring {
+	unsigned int size;					/**< Number of frame buffers (power of 2) */
+	unsigned int frame_bytes;				/**< Size of each frame buffer */
+	unsigned int head ____cacheline_aligned_in_smp;	/**< Frames published by the tasklet */
+	unsigned int lost;					/**< Newest frames lost by the tasklet, ring full */
+	unsigned int tail ____cacheline_aligned_in_smp;	/**< Frames released by the work */
+	unsigned int skipped;					/**< Older frames skipped by the work */
+};
+
+
+/**
+ * @enum T_LNT_SYNC_STREAM
+ *   Streams of the pairing stage
+ */
+typedef enum {
+	LNT_SYNC_RGB = 0,
+	LNT_SYNC_DEPTH = 1,
+	LNT_SYNC_NSTREAMS = 2
+} T_LNT_SYNC_STREAM;
+
+
+/**
+ * @struct linect_sync
+ *
+ * Pairing of the RGB and depth images by device timestamp. The first image
+ * of a pair takes a new sequence number, and its mate takes the same one.
+ */
+struct linect_sync {
+	spinlock_t lock;
+	unsigned int tolerance;				/**< Maximal skew of a pair in device ticks, 0 if disabled */
+	unsigned int sequence;				/**< Next shared sequence number */
+	int pending[LNT_SYNC_NSTREAMS];		/**< Image waiting for its mate */
+	uint32_t timestamp[LNT_SYNC_NSTREAMS];	/**< Timestamp of the waiting image */
+	unsigned int pending_seq[LNT_SYNC_NSTREAMS];	/**< Sequence number of the waiting image */
+	unsigned int last_seq[LNT_SYNC_NSTREAMS];	/**< Last sequence number of the stream */
+	// Statistics
+	unsigned long pairs;				/**< Images paired */
+	unsigned long unpaired[LNT_SYNC_NSTREAMS];	/**< Images without mate */
+	int skew;							/**< Skew of the last pair (depth - rgb) */
+	int skew_min;
+	int skew_max;
+	u64 skew_sum;						/**< Sum of the absolute skews */
 };
 
 
@@ -182,6 +285,12 @@ struct linect_frame_buf {
 struct linect_image_buf {
 	unsigned long offset;				/**< Memory offset */
 	int vma_use_count;					/**< VMA counter */
+	struct list_head list;				/**< Entry in the queued or done list */
+	unsigned long userptr;				/**< User buffer, V4L2_MEMORY_USERPTR */
+	unsigned int length;				/**< Size of the user buffer */
+	struct page **pages;				/**< Pinned pages of the user buffer */
+	unsigned int npages;				/**< Number of pinned pages */
+	void *data;							/**< Kernel mapping of the user buffer */
 };
 
 
@@ -201,8 +310,10 @@ struct linect_video {
 	int brightness;						/**< Brightness setting */
 	int depth;							/**< Depth colour setting */
 	int palette;						/**< Palette setting */
+	int fps;							/**< Frame rate setting */
 };
 
+
 typedef enum {
 	LED_OFF    = 0,
 	LED_GREEN  = 1,
@@ -230,11 +341,23 @@ typedef struct {
 typedef struct {
 	struct usb_linect *dev;
 	struct urb **xfers;
-	uint8_t *buffer;
 	int num_xfers;
 	int pkts;
 	int len;
+	int batch;
 	uint8_t type;
+	// Completion statistics
+	unsigned long completions;
+	unsigned long interrupts;
+	unsigned long start;
+	unsigned long last;
+	// Completed transfers, reassembled by the tasklet
+	struct tasklet_struct tasklet;
+	spinlock_t lock;
+	struct urb **done;
+	int done_head;
+	int done_count;
+	int stopping;
 } fnusb_isoc_stream;
 
 struct pkt_hdr {
@@ -282,11 +405,15 @@ struct linect_cam {
 
 	size_t isoc_in_size;
 	__u8 isoc_in_endpointAddr;
+	int isoc_xfers;				/* URBs per stream */
+	int isoc_pkts;				/* Packets per URB */
+	int isoc_batch;				/* URBs per completion interrupt */
 
 	int watchdog;
 
 	struct linect_video vsettings;
 	struct linect_video depth_vsettings;
+	int brightness_offset;			/* Added by the decoders, see linect_set_brightness */
 	
 	int error_status;
 
@@ -306,6 +433,12 @@ struct linect_cam {
 	struct mutex modlock_rgb;
 	struct mutex modlock_depth;
 
+	// Frame conversion
+	struct usb_linect *dev;
+	struct workqueue_struct *workqueue;
+	struct work_struct rgb_work;
+	struct work_struct depth_work;
+	struct list_head pool;			/* Kept buffers, see linect_pool_add */
 
 	// 1: isoc
 	char rgb_isoc_init_ok;
@@ -317,20 +450,20 @@ struct linect_cam {
 	// 2: streams
 	packet_stream depth_stream;
 	packet_stream rgb_stream;
+	int rgb_format;				/* See T_LNT_RGB_FORMAT */
+	int depth_format;			/* See T_LNT_DEPTH_FORMAT */
 
 	// 3: frame rgb
 	int frame_size;
 	struct linect_frame_buf *framebuf;
-	struct linect_frame_buf *empty_frames, *empty_frames_tail;
-	struct linect_frame_buf *full_frames, *full_frames_tail;
+	struct linect_frame_ring frame_ring;
 	struct linect_frame_buf *fill_frame;
 	struct linect_frame_buf *read_frame;
 	
 	// 3: frame depth
 	int frame_size_depth;
 	struct linect_frame_buf *framebuf_depth;
-	struct linect_frame_buf *empty_frames_depth, *empty_frames_tail_depth;
-	struct linect_frame_buf *full_frames_depth, *full_frames_tail_depth;
+	struct linect_frame_ring frame_ring_depth;
 	struct linect_frame_buf *fill_frame_depth;
 	struct linect_frame_buf *read_frame_depth;
 
@@ -340,10 +473,19 @@ struct linect_cam {
 	void *image_data;
 	struct linect_image_buf images[LNT_MAX_IMAGES];
 	int image_used[LNT_MAX_IMAGES];
+	int image_state[LNT_MAX_IMAGES];	/* See T_LNT_IMAGE_STATE */
+	unsigned int image_seq[LNT_MAX_IMAGES];	/* Sequence number of the image */
 	unsigned int nbuffers;
 	unsigned int len_per_image;
+	int memory;					/* V4L2_MEMORY_MMAP or V4L2_MEMORY_USERPTR */
+	struct linect_image_buf user_image;	/* Buffer of a whole frame read() */
+	int user_image_state;			/* See T_LNT_IMAGE_STATE */
 	int image_read_pos;
-	int fill_image;
+	int fill_image;				/* Image being converted, -1 if none */
+	struct list_head queued_images;		/* Images given to the driver */
+	struct list_head done_images;		/* Images waiting to be dequeued */
+	int read_image;				/* Last image dequeued, -1 if none */
+	unsigned int sequence;			/* Number of images converted */
 	struct linect_coord view;
 	struct linect_coord image;
 	
@@ -353,14 +495,26 @@ struct linect_cam {
 	void *image_data_depth;
 	struct linect_image_buf images_depth[LNT_MAX_IMAGES];
 	int image_used_depth[LNT_MAX_IMAGES];
+	int image_state_depth[LNT_MAX_IMAGES];
+	unsigned int image_seq_depth[LNT_MAX_IMAGES];
 	unsigned int nbuffers_depth;
 	unsigned int len_per_image_depth;
+	int memory_depth;
+	struct linect_image_buf user_image_depth;
+	int user_image_state_depth;
 	int image_read_pos_depth;
 	int fill_image_depth;
+	struct list_head queued_images_depth;
+	struct list_head done_images_depth;
+	int read_image_depth;
+	unsigned int sequence_depth;
 	int resolution_depth;
 	struct linect_coord view_depth;
 	struct linect_coord image_depth;
 	uint8_t *image_tmp;
+
+	// 5: RGB and depth pairing
+	struct linect_sync sync;
 	
 	// Options
 	char startupinit;
@@ -391,6 +545,9 @@ int usb_linect_set_configuration(struct usb_linect *);
 int usb_linect_rgb_isoc_init(struct usb_linect *);
 int usb_linect_depth_isoc_init(struct usb_linect *);
 void usb_linect_isoc_handler(struct urb *);
+void usb_linect_isoc_tasklet(unsigned long);
+void linect_rgb_stream_geometry(struct usb_linect *);
+void linect_depth_stream_geometry(struct usb_linect *);
 void usb_linect_rgb_isoc_cleanup(struct usb_linect *);
 void usb_linect_depth_isoc_cleanup(struct usb_linect *);
 
@@ -404,28 +561,71 @@ int linect_allocate_rgb_buffers(struct usb_linect *);
 int linect_reset_rgb_buffers(struct usb_linect *);
 int linect_clear_rgb_buffers(struct usb_linect *);
 int linect_free_rgb_buffers(struct usb_linect *);
+int linect_set_rgb_nbuffers(struct usb_linect *, unsigned int);
+int linect_set_rgb_image_len(struct usb_linect *, unsigned int);
+int linect_set_rgb_frame_len(struct usb_linect *, unsigned int);
+int linect_get_rgb_image(struct usb_linect *);
 void linect_next_rgb_image(struct usb_linect *);
+int linect_queue_rgb_image(struct usb_linect *, unsigned int);
+void linect_flush_rgb_images(struct usb_linect *);
+int linect_rgb_userptr_queued(struct usb_linect *);
+int linect_arm_rgb_read(struct usb_linect *, unsigned long, unsigned int);
+void linect_disarm_rgb_read(struct usb_linect *);
 int linect_next_rgb_frame(struct usb_linect *);
 int linect_handle_rgb_frame(struct usb_linect *);
+void linect_rgb_work(struct work_struct *);
 
 int linect_allocate_depth_buffers(struct usb_linect *);
 int linect_reset_depth_buffers(struct usb_linect *);
 int linect_clear_depth_buffers(struct usb_linect *);
 int linect_free_depth_buffers(struct usb_linect *);
+int linect_set_depth_nbuffers(struct usb_linect *, unsigned int);
+int linect_get_depth_image(struct usb_linect *);
 void linect_next_depth_image(struct usb_linect *);
+int linect_queue_depth_image(struct usb_linect *, unsigned int);
+void linect_flush_depth_images(struct usb_linect *);
+int linect_depth_userptr_queued(struct usb_linect *);
+int linect_arm_depth_read(struct usb_linect *, unsigned long, unsigned int);
+void linect_disarm_depth_read(struct usb_linect *);
 int linect_next_depth_frame(struct usb_linect *);
 int linect_handle_depth_frame(struct usb_linect *);
-
-int linect_rgb_decompress(struct usb_linect *);
-int linect_depth_decompress(struct usb_linect *);
+void linect_depth_work(struct work_struct *);
+
+void linect_sync_init(struct usb_linect *, unsigned int);
+void linect_sync_reset(struct usb_linect *, int);
+
+void linect_pool_init(void);
+void linect_pool_exit(void);
+void linect_pool_add(struct usb_linect *);
+void linect_pool_del(struct usb_linect *);
+
+int linect_rgb_decompress(struct usb_linect *, void *);
+int linect_depth_decompress(struct usb_linect *, uint8_t *);
+void linect_bayer_init(void);
+void linect_set_brightness(struct usb_linect *);
+
+// SIMD
+#if defined(LNT_SIMD_X86)
+int linect_bayer_row_sse2(const uint8_t *, const uint8_t *, const uint8_t *, uint8_t *, int, int, int, int, int);
+#if defined(LNT_SIMD_SSSE3)
+int linect_bayer_row_ssse3(const uint8_t *, const uint8_t *, const uint8_t *, uint8_t *, int, int, int, int, int);
+int linect_depth_unpack_ssse3(const uint8_t *, uint16_t *, int);
+#endif
+#endif
 
 void * linect_rvmalloc(unsigned long size);
 void linect_rvfree(void *mem, unsigned long size);
+int linect_pin_image(struct linect_image_buf *, unsigned long, unsigned int);
+void linect_unpin_image(struct linect_image_buf *);
 
 // Proc
 void linect_proc_create(struct usb_linect *dev);
 void linect_proc_destroy(struct usb_linect *dev);
 
+// Sysfs
+int linect_create_sysfs_files(struct video_device *);
+void linect_remove_sysfs_files(struct video_device *);
+
 // Cam
 int linect_cam_init(struct usb_linect *dev);
 int linect_cam_start_rgb(struct usb_linect *dev);
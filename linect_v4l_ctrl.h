@@ -35,4 +35,16 @@
 #define V4L2_CCID_MOTOR V4L2_CID_PRIVATE_BASE+0
 #define V4L2_CCID_LED V4L2_CID_PRIVATE_BASE+1
 
+// Depth as sent by the camera : 11 bits per pixel, MSB first, no padding
+#define V4L2_PIX_FMT_LNT_Y11P v4l2_fourcc('Y', '1', '1', 'P')
+
+// 10 bits depth, missing in old kernels
+#ifndef V4L2_PIX_FMT_Y10
+#define V4L2_PIX_FMT_Y10 v4l2_fourcc('Y', '1', '0', ' ')
+#endif
+
+#ifndef V4L2_PIX_FMT_Y10BPACK
+#define V4L2_PIX_FMT_Y10BPACK v4l2_fourcc('Y', '1', '0', 'B')
+#endif
+
 #endif 